@@ -0,0 +1,386 @@
+/*! @file
+ *  This file contains the synthetic stream benchmark and validation of
+ *  the cache core
+ */
+
+#ifndef PIN_BENCH_H
+#define PIN_BENCH_H
+
+#include <math.h>
+#include <time.h>
+
+#include "dcache.h"
+
+typedef enum
+{
+    BENCH_SEQUENTIAL,
+    BENCH_STRIDED,
+    BENCH_RANDOM,
+    BENCH_ZIPF,
+    BENCH_CHASE,
+    BENCH_UNALIGNED,        // every access spans two lines
+    BENCH_STREAM_NUM
+} BENCH_STREAM;
+
+static const char * const BENCH_STREAM_NAMES[BENCH_STREAM_NUM] =
+{
+    "sequential", "strided", "random", "zipf", "chase", "unaligned"
+};
+
+typedef struct
+{
+    ADDRINT addr;
+    UINT32 size;
+    ACCESS_TYPE type;
+} BENCH_ACCESS;
+
+/*!
+ *  @brief xorshift64*, the streams are the same on every host
+ */
+class BENCH_RANDOM_GEN
+{
+private:
+    UINT64 _state;
+
+public:
+    BENCH_RANDOM_GEN(UINT64 seed) : _state(seed) {}
+
+    UINT64 Next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 2685821657736338717ULL;
+    }
+
+    /// Uniform in [0, n)
+    UINT64 Below(UINT64 n) { return Next() % n; }
+};
+
+/*!
+ *  @brief Fill accesses with n accesses of a stream, a quarter of them stores
+ */
+VOID BenchGenerate(BENCH_STREAM stream, UINT64 n, std::vector<BENCH_ACCESS> & accesses)
+{
+    const ADDRINT base = 0x10000000;
+    const UINT64 lines = 256 * KILO;        // 16MB footprint
+
+    BENCH_RANDOM_GEN random(stream + 1);
+    accesses.resize(n);
+
+    std::vector<double> cdf;
+    std::vector<UINT32> next;
+    if (stream == BENCH_ZIPF)
+    {
+        // exponent 0.99 over the lines
+        cdf.resize(lines);
+        double sum = 0;
+        for (UINT64 i = 0; i < lines; i++)
+        {
+            sum += 1.0 / pow(double(i + 1), 0.99);
+            cdf[i] = sum;
+        }
+        for (UINT64 i = 0; i < lines; i++)
+            cdf[i] /= sum;
+    }
+    else if (stream == BENCH_CHASE)
+    {
+        // one random cycle through every line (Sattolo)
+        next.resize(lines);
+        for (UINT64 i = 0; i < lines; i++)
+            next[i] = i;
+        for (UINT64 i = lines - 1; i > 0; i--)
+            std::swap(next[i], next[random.Below(i)]);
+    }
+
+    UINT64 line = 0;
+    for (UINT64 i = 0; i < n; i++)
+    {
+        BENCH_ACCESS & access = accesses[i];
+        access.size = 8;
+
+        switch (stream)
+        {
+          case BENCH_SEQUENTIAL:
+            access.addr = base + (i * 8) % (lines * 64);
+            break;
+          case BENCH_STRIDED:
+            // 65 lines apart, so consecutive accesses move to the next set
+            access.addr = base + (i * 65 * 64) % (lines * 64);
+            break;
+          case BENCH_RANDOM:
+            access.addr = base + random.Below(lines * 8) * 8;
+            break;
+          case BENCH_ZIPF:
+          {
+            const double u = double(random.Next() >> 11) / double(1ULL << 53);
+            const UINT64 rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            // scatter the popular lines over the sets
+            access.addr = base + ((rank * 40503) % lines) * 64;
+            break;
+          }
+          case BENCH_CHASE:
+            line = next[line];
+            access.addr = base + line * 64;
+            break;
+          default:
+            access.addr = base + (i % lines) * 64 + 56;
+            access.size = 16;
+            break;
+        }
+        access.type = (random.Below(4) == 0) ? ACCESS_TYPE_STORE : ACCESS_TYPE_LOAD;
+    }
+}
+
+/*!
+ *  @brief Obvious model of a non-inclusive write-back LRU level, the golden
+ *  reference for CACHE
+ *
+ *  Every line carries the time of its last use, a miss evicts the oldest
+ *  one. The order of events matches CACHE: the victim goes down before
+ *  the missing line is fetched, and stores that miss fetch as stores.
+ */
+class REF_CACHE
+{
+private:
+    typedef struct
+    {
+        ADDRINT tag;
+        UINT64 used;
+        bool dirty;
+    } LINE;
+
+    std::vector<std::vector<LINE> > _sets;
+    const UINT32 _lineShift;
+    const UINT32 _associativity;
+    UINT64 _time;
+    REF_CACHE * _next;
+
+    VOID Put(std::vector<LINE> & set, ADDRINT tag, bool dirty)
+    {
+        if (set.size() == _associativity)
+        {
+            size_t oldest = 0;
+            for (size_t i = 1; i < set.size(); i++)
+            {
+                if (set[i].used < set[oldest].used)
+                    oldest = i;
+            }
+            if (set[oldest].dirty)
+            {
+                writebacks++;
+                if (_next != NULL)
+                    _next->Install(set[oldest].tag << _lineShift);
+                else
+                    memory++;
+            }
+            set.erase(set.begin() + oldest);
+        }
+
+        LINE line = { tag, ++_time, dirty };
+        set.push_back(line);
+    }
+
+    LINE * Find(std::vector<LINE> & set, ADDRINT tag)
+    {
+        for (size_t i = 0; i < set.size(); i++)
+        {
+            if (set[i].tag == tag)
+            {
+                set[i].used = ++_time;
+                return &set[i];
+            }
+        }
+        return NULL;
+    }
+
+public:
+    UINT64 hits;
+    UINT64 misses;
+    UINT64 writebacks;
+    UINT64 memory;          // reads and writes below the last level
+
+    REF_CACHE(UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, REF_CACHE * next)
+            : _sets(cacheSize / (lineSize * associativity)),
+              _lineShift(FloorLog2(lineSize)),
+              _associativity(associativity),
+              _time(0),
+              _next(next),
+              hits(0),
+              misses(0),
+              writebacks(0),
+              memory(0)
+    {
+    }
+
+    bool AccessLine(ADDRINT addr, ACCESS_TYPE type)
+    {
+        const ADDRINT tag = addr >> _lineShift;
+        std::vector<LINE> & set = _sets[tag % _sets.size()];
+
+        LINE * line = Find(set, tag);
+        if (line != NULL)
+        {
+            line->dirty |= (type == ACCESS_TYPE_STORE);
+            return true;
+        }
+
+        Put(set, tag, type == ACCESS_TYPE_STORE);
+        if (_next != NULL)
+            _next->Access(addr, 1, type);
+        else
+            memory++;
+        return false;
+    }
+
+    VOID Access(ADDRINT addr, UINT32 size, ACCESS_TYPE type)
+    {
+        const ADDRINT lineSize = ADDRINT(1) << _lineShift;
+        const ADDRINT highAddr = addr + size;
+        bool allHit = true;
+        do
+        {
+            allHit &= AccessLine(addr, type);
+            addr = (addr & ~(lineSize - 1)) + lineSize;
+        }
+        while (addr < highAddr);
+
+        if (allHit)
+            hits++;
+        else
+            misses++;
+    }
+
+    /// Dirty line written back from the level above
+    VOID Install(ADDRINT addr)
+    {
+        const ADDRINT tag = addr >> _lineShift;
+        std::vector<LINE> & set = _sets[tag % _sets.size()];
+
+        LINE * line = Find(set, tag);
+        if (line != NULL)
+            line->dirty = true;
+        else
+            Put(set, tag, true);
+    }
+};
+
+typedef struct
+{
+    const char * name;
+    UINT32 l1Size;          // 0 for a single level
+    UINT32 l1Associativity;
+    UINT32 l2Size;
+    UINT32 l2Associativity;
+} BENCH_CONFIG;
+
+static const BENCH_CONFIG BENCH_CONFIGS[] =
+{
+    { "l1",     0,         0,  32 * KILO,   8 },
+    { "l2",     0,         0,  1024 * KILO, 16 },
+    { "l1+l2",  32 * KILO, 8,  1024 * KILO, 16 },
+};
+
+inline double BenchSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+string BenchRow(const char * stream, const char * config, const char * policy,
+                UINT64 n, double seconds, string result)
+{
+    return ljstr(stream, 12) + ljstr(config, 8) + ljstr(policy, 9)
+           + fltstr(n / seconds / 1e6, 2, 12) + fltstr(seconds * 1e9 / n, 2, 12)
+           + "  " + result + "\n";
+}
+
+/*!
+ *  @brief Run every stream through every configuration, built once by
+ *  fixed and once by generic, plus the tiered memory
+ *  @return the number of runs whose counts differ from the reference
+ */
+UINT32 RunBench(std::ostream & out, UINT64 n, CACHE_FACTORY fixed, CACHE_FACTORY generic)
+{
+    const UINT32 lineSize = 64;
+    const UINT64 savedInsCount = ins_count;
+    UINT32 mismatches = 0;
+
+    out << "# stream    config  policy     Macc/s     ns/access  result\n";
+
+    std::vector<BENCH_ACCESS> accesses;
+    for (UINT32 s = 0; s < BENCH_STREAM_NUM; s++)
+    {
+        BenchGenerate(BENCH_STREAM(s), n, accesses);
+
+        for (UINT32 c = 0; c < sizeof(BENCH_CONFIGS) / sizeof(BENCH_CONFIGS[0]); c++)
+        {
+            const BENCH_CONFIG & config = BENCH_CONFIGS[c];
+
+            REF_CACHE refL2(config.l2Size, lineSize, config.l2Associativity, NULL);
+            REF_CACHE refL1(config.l1Size ? config.l1Size : lineSize, lineSize,
+                            config.l1Size ? config.l1Associativity : 1, &refL2);
+            REF_CACHE & refTop = config.l1Size ? refL1 : refL2;
+            for (UINT64 i = 0; i < n; i++)
+                refTop.Access(accesses[i].addr, accesses[i].size, accesses[i].type);
+
+            for (UINT32 p = 0; p < 2; p++)
+            {
+                CACHE_FACTORY create = (p == 0) ? fixed : generic;
+
+                // no penalties, the clock of the tool is left alone
+                CACHE_LEVEL * l2 = create("bench L2 ", config.l2Size, lineSize, config.l2Associativity, 0, 0);
+                CACHE_LEVEL * l1 = NULL;
+                CACHE_STATS memory = 0;
+                l2->setMemoryCounter(&memory);
+                if (config.l1Size != 0)
+                {
+                    l1 = create("bench L1 ", config.l1Size, lineSize, config.l1Associativity, 0, 0);
+                    l1->setNextLevel(l2);
+                    l2->addPrevLevel(l1);
+                }
+                CACHE_LEVEL * top = (l1 != NULL) ? l1 : l2;
+
+                const double start = BenchSeconds();
+                for (UINT64 i = 0; i < n; i++)
+                    top->Access(accesses[i].addr, accesses[i].size, accesses[i].type);
+                const double seconds = BenchSeconds() - start;
+
+                bool same = l2->Hits() == refL2.hits && l2->Misses() == refL2.misses
+                            && l2->Writebacks() == refL2.writebacks && memory == refL2.memory;
+                if (l1 != NULL)
+                    same &= l1->Hits() == refL1.hits && l1->Misses() == refL1.misses
+                            && l1->Writebacks() == refL1.writebacks;
+                mismatches += !same;
+
+                // misses and writebacks, simulated/reference
+                string result = same ? "ok" : "MISMATCH";
+                if (l1 != NULL)
+                    result += "  l1 " + decstr(l1->Misses()) + "/" + decstr(refL1.misses)
+                              + " wb " + decstr(l1->Writebacks()) + "/" + decstr(refL1.writebacks);
+                result += string("  ") + (l1 != NULL ? "l2" : config.name) + " " + decstr(l2->Misses()) + "/" + decstr(refL2.misses)
+                          + " wb " + decstr(l2->Writebacks()) + "/" + decstr(refL2.writebacks);
+
+                out << BenchRow(BENCH_STREAM_NAMES[s], config.name, p == 0 ? "fixed" : "generic",
+                                n, seconds, result);
+                delete l1;
+                delete l2;
+            }
+        }
+
+        // every access of the stream straight into memory with a small fast tier
+        Memory * memory = new Memory(1024, 100, 64);
+        const double start = BenchSeconds();
+        for (UINT64 i = 0; i < n; i++)
+            memory->Access(accesses[i].addr, accesses[i].type);
+        out << BenchRow(BENCH_STREAM_NAMES[s], "memory", "tiers", n, BenchSeconds() - start, "-");
+        delete memory;
+    }
+    out << "# " << mismatches << " runs differ from the reference\n";
+
+    ins_count = savedInsCount;
+    return mismatches;
+}
+
+#endif // PIN_BENCH_H
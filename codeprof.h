@@ -0,0 +1,395 @@
+/*! @file
+ *  This file contains the per image, per routine and per calling context
+ *  aggregation of the instruction profile
+ */
+
+#ifndef PIN_CODEPROF_H
+#define PIN_CODEPROF_H
+
+#include <unordered_map>
+
+#include "dcache.h"
+#include "pcprofile.h"
+
+#define CODE_MAX_THREADS 1024
+
+/*!
+ *  @brief Cache statistics by image and routine, and optionally by calling
+ *  context
+ *
+ *  Images and routines get dense IDs at instrumentation time, and so does
+ *  every profiled instruction's routine. The flat statistics cost nothing
+ *  at analysis time, they are summed from the instruction profile for the
+ *  report.
+ *
+ *  The calling context tree is kept per thread by a shadow stack that is
+ *  pushed at routine entry and popped at returns. Frames are matched by
+ *  stack pointer, so frames left by longjmp or exceptions are dropped at
+ *  the next return and a tail call replaces its caller. Contexts deeper
+ *  than the configured depth are folded into their ancestor, and the
+ *  current context's counters are one index away at analysis time.
+ */
+template <UINT32 NUM>
+class CODE_PROFILE
+{
+private:
+    typedef struct
+    {
+        string name;
+        UINT32 image;
+    } ROUTINE;
+
+    typedef struct
+    {
+        UINT32 parent;
+        UINT32 routine;
+        UINT64 counters[NUM];
+    } NODE;
+
+    typedef struct
+    {
+        UINT32 node;
+        ADDRINT sp;                 // stack pointer at routine entry
+    } FRAME;
+
+    typedef struct
+    {
+        std::vector<NODE> nodes;    // 0 is the root
+        std::unordered_map<UINT64, UINT32> children;
+        std::vector<FRAME> stack;
+    } THREAD;
+
+    std::vector<string> _images;
+    std::unordered_map<UINT32, UINT32> _imageIds;       // by IMG_Id
+    std::vector<ROUTINE> _routines;
+    std::unordered_map<ADDRINT, UINT32> _routineIds;    // by routine address
+    std::vector<UINT32> _instRoutines;                  // by instruction profile ID
+    THREAD * _threads[CODE_MAX_THREADS];
+    const UINT32 _depth;
+
+    THREAD * AddThread(THREADID tid);
+    UINT32 Child(THREAD * thread, UINT32 parent, UINT32 routine);
+
+    string Header(string prefix, string first, const PC_PROFILE<NUM> & profile) const;
+
+public:
+    /// depth is the deepest calling context kept, 0 for none
+    CODE_PROFILE(UINT32 depth);
+
+    bool Contexts() const { return _depth != 0; }
+
+    /// Dense ID of a routine, only at instrumentation time
+    UINT32 RoutineId(RTN rtn);
+
+    /// Remember the routine of a profiled instruction
+    VOID MapInstruction(UINT32 instId, RTN rtn);
+
+    VOID Enter(THREADID tid, UINT32 routine, ADDRINT sp);
+    VOID Return(THREADID tid, ADDRINT sp);
+
+    /// Counters of the thread's current calling context
+    inline UINT64 * Context(THREADID tid)
+    {
+        THREAD * thread = _threads[tid];
+        if (thread == NULL)
+            thread = AddThread(tid);
+        const UINT32 node = thread->stack.empty() ? 0 : thread->stack.back().node;
+        return thread->nodes[node].counters;
+    }
+
+    string StatsLong(string prefix, const PC_PROFILE<NUM> & profile,
+                     UINT32 sortCounter, UINT32 top) const;
+    string ContextsLong(string prefix, const PC_PROFILE<NUM> & profile,
+                        UINT32 sortCounter, UINT32 top) const;
+};
+
+template <UINT32 NUM>
+CODE_PROFILE<NUM>::CODE_PROFILE(UINT32 depth)
+        : _depth(depth)
+{
+    _images.push_back("[unknown]");
+
+    ROUTINE unknown;
+    unknown.name = "[unknown]";
+    unknown.image = 0;
+    _routines.push_back(unknown);
+
+    for (UINT32 i = 0; i < CODE_MAX_THREADS; i++)
+        _threads[i] = NULL;
+}
+
+template <UINT32 NUM>
+UINT32 CODE_PROFILE<NUM>::RoutineId(RTN rtn)
+{
+    if (!RTN_Valid(rtn))
+        return 0;
+
+    std::unordered_map<ADDRINT, UINT32>::iterator it = _routineIds.find(RTN_Address(rtn));
+    if (it != _routineIds.end())
+        return it->second;
+
+    ROUTINE routine;
+    routine.name = RTN_Name(rtn);
+    routine.image = 0;
+
+    IMG img = SEC_Img(RTN_Sec(rtn));
+    if (IMG_Valid(img))
+    {
+        std::unordered_map<UINT32, UINT32>::iterator image = _imageIds.find(IMG_Id(img));
+        if (image == _imageIds.end())
+        {
+            const string & name = IMG_Name(img);
+            _images.push_back(name.substr(name.find_last_of('/') + 1));
+            image = _imageIds.insert(std::make_pair(IMG_Id(img), UINT32(_images.size() - 1))).first;
+        }
+        routine.image = image->second;
+    }
+
+    _routines.push_back(routine);
+    _routineIds[RTN_Address(rtn)] = _routines.size() - 1;
+    return _routines.size() - 1;
+}
+
+template <UINT32 NUM>
+VOID CODE_PROFILE<NUM>::MapInstruction(UINT32 instId, RTN rtn)
+{
+    if (instId >= _instRoutines.size())
+        _instRoutines.resize(instId + 1, 0);
+    _instRoutines[instId] = RoutineId(rtn);
+}
+
+template <UINT32 NUM>
+typename CODE_PROFILE<NUM>::THREAD * CODE_PROFILE<NUM>::AddThread(THREADID tid)
+{
+    ASSERTX(tid < CODE_MAX_THREADS);
+
+    THREAD * thread = new THREAD;
+    NODE root;
+    memset(&root, 0, sizeof(root));
+    thread->nodes.push_back(root);
+    _threads[tid] = thread;
+    return thread;
+}
+
+template <UINT32 NUM>
+UINT32 CODE_PROFILE<NUM>::Child(THREAD * thread, UINT32 parent, UINT32 routine)
+{
+    const UINT64 key = (UINT64(parent) << 32) | routine;
+    std::unordered_map<UINT64, UINT32>::iterator it = thread->children.find(key);
+    if (it != thread->children.end())
+        return it->second;
+
+    NODE node;
+    memset(&node, 0, sizeof(node));
+    node.parent = parent;
+    node.routine = routine;
+    thread->nodes.push_back(node);
+
+    const UINT32 id = thread->nodes.size() - 1;
+    thread->children[key] = id;
+    return id;
+}
+
+template <UINT32 NUM>
+VOID CODE_PROFILE<NUM>::Enter(THREADID tid, UINT32 routine, ADDRINT sp)
+{
+    THREAD * thread = _threads[tid];
+    if (thread == NULL)
+        thread = AddThread(tid);
+
+    std::vector<FRAME> & stack = thread->stack;
+    while (!stack.empty() && stack.back().sp <= sp)
+        stack.pop_back();
+
+    const UINT32 parent = stack.empty() ? 0 : stack.back().node;
+
+    FRAME frame;
+    frame.node = (stack.size() < _depth) ? Child(thread, parent, routine) : parent;
+    frame.sp = sp;
+    stack.push_back(frame);
+}
+
+template <UINT32 NUM>
+VOID CODE_PROFILE<NUM>::Return(THREADID tid, ADDRINT sp)
+{
+    THREAD * thread = _threads[tid];
+    if (thread == NULL)
+        return;
+
+    // a return finds the stack pointer where its routine's entry left it
+    std::vector<FRAME> & stack = thread->stack;
+    while (!stack.empty() && stack.back().sp <= sp)
+        stack.pop_back();
+}
+
+template <UINT32 NUM>
+string CODE_PROFILE<NUM>::Header(string prefix, string first, const PC_PROFILE<NUM> & profile) const
+{
+    const UINT32 numberWidth = 14;
+
+    string out = prefix + first;
+    for (UINT32 c = 0; c < NUM; c++)
+    {
+        const string & name = profile.CounterName(c);
+        out += std::string(numberWidth - std::min<size_t>(numberWidth - 1, name.size()), ' ') + name;
+    }
+    return out;
+}
+
+/*!
+ *  @brief Stats output method, one table of images and one of routines
+ */
+template <UINT32 NUM>
+string CODE_PROFILE<NUM>::StatsLong(string prefix, const PC_PROFILE<NUM> & profile,
+                                    UINT32 sortCounter, UINT32 top) const
+{
+    const UINT32 numberWidth = 14;
+
+    std::vector<UINT64> totals;
+    profile.Totals(totals);
+
+    std::vector<UINT64> routines(_routines.size() * NUM, 0);
+    std::vector<UINT64> images(_images.size() * NUM, 0);
+    for (UINT32 id = 0; id < profile.NumInstructions(); id++)
+    {
+        const UINT32 routine = (id < _instRoutines.size()) ? _instRoutines[id] : 0;
+        const UINT32 image = _routines[routine].image;
+        for (UINT32 c = 0; c < NUM; c++)
+        {
+            routines[routine * NUM + c] += totals[id * NUM + c];
+            images[image * NUM + c] += totals[id * NUM + c];
+        }
+    }
+
+    string out;
+
+    std::vector<std::pair<UINT64, UINT32> > order;
+    for (UINT32 i = 0; i < _images.size(); i++)
+        order.push_back(std::make_pair(images[i * NUM + sortCounter], i));
+    std::sort(order.begin(), order.end(), std::greater<std::pair<UINT64, UINT32> >());
+
+    out += Header(prefix, ljstr("rank", 6), profile) + "  image\n";
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const UINT32 image = order[i].second;
+        out += prefix + ljstr(decstr(i + 1), 6);
+        for (UINT32 c = 0; c < NUM; c++)
+            out += mydecstr(images[image * NUM + c], numberWidth);
+        out += "  " + _images[image] + "\n";
+    }
+    out += "\n";
+
+    order.clear();
+    for (UINT32 i = 0; i < _routines.size(); i++)
+    {
+        if (routines[i * NUM + sortCounter] != 0)
+            order.push_back(std::make_pair(routines[i * NUM + sortCounter], i));
+    }
+    std::sort(order.begin(), order.end(), std::greater<std::pair<UINT64, UINT32> >());
+    if (top != 0 && order.size() > top)
+        order.resize(top);
+
+    out += Header(prefix, ljstr("rank", 6), profile) + "  routine  image\n";
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const UINT32 routine = order[i].second;
+        out += prefix + ljstr(decstr(i + 1), 6);
+        for (UINT32 c = 0; c < NUM; c++)
+            out += mydecstr(routines[routine * NUM + c], numberWidth);
+        out += "  " + _routines[routine].name + "  " + _images[_routines[routine].image] + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+/*!
+ *  @brief Calling context tree output method
+ *
+ *  The threads' trees are merged by path. Children are listed below their
+ *  parent with the most events of sortCounter in their subtree first;
+ *  subtrees without any are left out, and so is everything after top
+ *  contexts.
+ */
+template <UINT32 NUM>
+string CODE_PROFILE<NUM>::ContextsLong(string prefix, const PC_PROFILE<NUM> & profile,
+                                       UINT32 sortCounter, UINT32 top) const
+{
+    const UINT32 numberWidth = 14;
+
+    // merged nodes, parents always before their children
+    std::vector<UINT32> parents(1, 0);
+    std::vector<UINT32> routines(1, 0);
+    std::vector<UINT64> counters(NUM, 0);
+    std::unordered_map<UINT64, UINT32> children;
+
+    for (UINT32 t = 0; t < CODE_MAX_THREADS; t++)
+    {
+        const THREAD * thread = _threads[t];
+        if (thread == NULL)
+            continue;
+
+        std::vector<UINT32> merged(thread->nodes.size(), 0);
+        for (UINT32 n = 0; n < thread->nodes.size(); n++)
+        {
+            const NODE & node = thread->nodes[n];
+            if (n != 0)
+            {
+                const UINT32 parent = merged[node.parent];
+                const UINT64 key = (UINT64(parent) << 32) | node.routine;
+                std::unordered_map<UINT64, UINT32>::iterator it = children.find(key);
+                if (it == children.end())
+                {
+                    parents.push_back(parent);
+                    routines.push_back(node.routine);
+                    counters.resize(counters.size() + NUM, 0);
+                    it = children.insert(std::make_pair(key, UINT32(parents.size() - 1))).first;
+                }
+                merged[n] = it->second;
+            }
+            for (UINT32 c = 0; c < NUM; c++)
+                counters[merged[n] * NUM + c] += node.counters[c];
+        }
+    }
+
+    std::vector<UINT64> inclusive(parents.size(), 0);
+    std::vector<std::vector<std::pair<UINT64, UINT32> > > kids(parents.size());
+    for (UINT32 n = parents.size() - 1; n > 0; n--)
+    {
+        inclusive[n] += counters[n * NUM + sortCounter];
+        inclusive[parents[n]] += inclusive[n];
+        if (inclusive[n] != 0)
+            kids[parents[n]].push_back(std::make_pair(inclusive[n], n));
+    }
+    inclusive[0] += counters[sortCounter];
+
+    string out;
+    out += Header(prefix, ljstr("subtree:" + profile.CounterName(sortCounter), 20), profile)
+           + "  context\n";
+
+    std::vector<std::pair<UINT32, UINT32> > pending;     // node, depth
+    pending.push_back(std::make_pair(0, 0));
+    UINT32 printed = 0;
+    while (!pending.empty() && (top == 0 || printed < top))
+    {
+        const UINT32 n = pending.back().first;
+        const UINT32 depth = pending.back().second;
+        pending.pop_back();
+
+        out += prefix + ljstr(decstr(inclusive[n]), 20);
+        for (UINT32 c = 0; c < NUM; c++)
+            out += mydecstr(counters[n * NUM + c], numberWidth);
+        out += "  " + std::string(2 * depth, ' ')
+               + ((n == 0) ? string("[root]") : _routines[routines[n]].name) + "\n";
+        printed++;
+
+        std::sort(kids[n].begin(), kids[n].end());
+        for (size_t k = 0; k < kids[n].size(); k++)
+            pending.push_back(std::make_pair(kids[n][k].second, depth + 1));
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_CODEPROF_H
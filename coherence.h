@@ -0,0 +1,261 @@
+/*! @file
+ *  This file contains a MESI directory for private per-core caches
+ */
+
+#ifndef PIN_COHERENCE_H
+#define PIN_COHERENCE_H
+
+#include <deque>
+#include <unordered_map>
+
+#include "dcache.h"
+
+#define MAX_COHERENT_CORES 32
+
+/*!
+ *  @brief Snoop filter entry of one line
+ *
+ *  The MESI state of the line in a core follows from the entry: M if the
+ *  core is the owner, E if it is the only sharer and not the owner, S if
+ *  there are other sharers and I if it is not a sharer.
+ */
+typedef struct
+{
+    UINT32 sharers;                         // cores holding the line
+    UINT32 invalidated;                     // cores that lost the line to a remote write
+    INT32 owner;                            // core holding it modified, -1 if none
+    UINT64 touched[MAX_COHERENT_CORES];     // bytes each core used since it got the line
+} DIRECTORY_ENTRY;
+
+/*!
+ *  @brief Directory at the shared L2 keeping the private L1s coherent
+ *
+ *  Every access is announced with Request() before it goes to the core's
+ *  L1. A store invalidates all other copies, a load downgrades a remote
+ *  modified copy to shared and writes it back into L2. The directory is
+ *  told about L1 evictions and back invalidations through the L1 eviction
+ *  listener.
+ *
+ *  A line no core holds any more is only kept to classify the next miss
+ *  of a core that lost it to a remote write. At most as many of them as
+ *  the L2 has lines are kept, the oldest are dropped first.
+ */
+template <class CACHE_T>
+class DIRECTORY
+{
+private:
+    CACHE_T ** _l1;
+    CACHE_T * _l2;
+    const UINT32 _numCores;
+    const UINT32 _lineShift;
+    std::unordered_map<ADDRINT, DIRECTORY_ENTRY> _entries;
+    std::deque<ADDRINT> _unheld;            // lines that lost their last sharer, oldest first
+    const UINT32 _maxUnheld;
+
+    CACHE_STATS _invalidations;
+    CACHE_STATS _falseSharing;
+    CACHE_STATS _downgrades;
+    CACHE_STATS _upgrades;
+    CACHE_STATS _coherenceMisses;
+    CACHE_STATS _agedOut;
+
+    VOID AgeOut();
+
+public:
+    DIRECTORY(CACHE_T ** l1, UINT32 numCores, CACHE_T * l2)
+            : _l1(l1),
+              _l2(l2),
+              _numCores(numCores),
+              _lineShift(FloorLog2(l2->LineSize())),
+              _maxUnheld(l2->CacheSize() / l2->LineSize())
+    {
+        ASSERTX(numCores <= MAX_COHERENT_CORES);
+        // byte masks in DIRECTORY_ENTRY::touched cover at most 64 bytes
+        ASSERTX(l2->LineSize() <= 64);
+
+        _invalidations = 0;
+        _falseSharing = 0;
+        _downgrades = 0;
+        _upgrades = 0;
+        _coherenceMisses = 0;
+        _agedOut = 0;
+    }
+
+    /// Coherence actions for core accessing [addr, addr+size) inside one line
+    /// @param invalidations number of remote copies this access invalidated
+    /// @param falseSharing how many of them shared no byte with this access
+    /// @return true if a miss of this access in the core's L1 is a coherence miss
+    bool Request(UINT32 core, ADDRINT addr, UINT32 size, ACCESS_TYPE accessType,
+                 UINT32 & invalidations, UINT32 & falseSharing);
+
+    VOID CoherenceMiss() { _coherenceMisses++; }
+
+    /// L1 eviction listener
+    static VOID Evicted(VOID * v, UINT32 core, ADDRINT addr);
+
+    string StatsLong(string prefix = "") const;
+};
+
+template <class CACHE_T>
+bool DIRECTORY<CACHE_T>::Request(UINT32 core, ADDRINT addr, UINT32 size, ACCESS_TYPE accessType,
+                                 UINT32 & invalidations, UINT32 & falseSharing)
+{
+    const ADDRINT line = addr >> _lineShift;
+    const ADDRINT lineAddr = line << _lineShift;
+    const UINT32 offset = addr - lineAddr;
+    const UINT64 bytes = (size >= 64) ? ~UINT64(0) : (((UINT64(1) << size) - 1) << offset);
+    const UINT32 coreBit = 1 << core;
+
+    invalidations = 0;
+    falseSharing = 0;
+
+    typename std::unordered_map<ADDRINT, DIRECTORY_ENTRY>::iterator it = _entries.find(line);
+    if (it == _entries.end())
+    {
+        DIRECTORY_ENTRY entry;
+        entry.sharers = 0;
+        entry.invalidated = 0;
+        entry.owner = -1;
+        for (UINT32 i = 0; i < MAX_COHERENT_CORES; i++)
+            entry.touched[i] = 0;
+        it = _entries.insert(std::make_pair(line, entry)).first;
+    }
+    DIRECTORY_ENTRY & entry = it->second;
+
+    const bool coherenceMiss = (entry.invalidated & coreBit) != 0;
+    entry.invalidated &= ~coreBit;
+
+    if (accessType == ACCESS_TYPE_STORE)
+    {
+        const UINT32 others = entry.sharers & ~coreBit;
+        if (others != 0 && (entry.sharers & coreBit))
+            _upgrades++;    // S -> M
+        // held by this core from here on, the listener won't drop the entry
+        entry.sharers |= coreBit;
+
+        for (UINT32 c = 0; c < _numCores; c++)
+        {
+            if (!(others & (1 << c)))
+                continue;
+
+            // marked up front, so the eviction listener keeps the entry
+            const UINT64 touched = entry.touched[c];
+            entry.invalidated |= (1 << c);
+
+            bool dirty;
+            if (_l1[c]->Snoop(lineAddr, dirty))
+            {
+                if (dirty)
+                    _l2->Install(_l1[c]->Below(lineAddr), true);
+
+                invalidations++;
+                if ((touched & bytes) == 0)
+                    falseSharing++;
+            }
+            else
+                entry.invalidated &= ~(1 << c);
+            entry.touched[c] = 0;
+        }
+
+        entry.sharers = coreBit;
+        entry.owner = core;
+    }
+    else
+    {
+        if (entry.owner >= 0 && UINT32(entry.owner) != core)
+        {
+            // M -> S, the owner's data goes back to L2
+            if (_l1[entry.owner]->Clean(lineAddr))
+                _l2->Install(_l1[entry.owner]->Below(lineAddr), true);
+            entry.owner = -1;
+            _downgrades++;
+        }
+        entry.sharers |= coreBit;
+    }
+    entry.touched[core] |= bytes;
+
+    _invalidations += invalidations;
+    _falseSharing += falseSharing;
+
+    return coherenceMiss;
+}
+
+template <class CACHE_T>
+VOID DIRECTORY<CACHE_T>::Evicted(VOID * v, UINT32 core, ADDRINT addr)
+{
+    DIRECTORY<CACHE_T> * directory = static_cast<DIRECTORY<CACHE_T> *>(v);
+    const ADDRINT line = addr >> directory->_lineShift;
+
+    typename std::unordered_map<ADDRINT, DIRECTORY_ENTRY>::iterator it = directory->_entries.find(line);
+    if (it == directory->_entries.end())
+        return;
+
+    DIRECTORY_ENTRY & entry = it->second;
+    entry.sharers &= ~(1 << core);
+    entry.touched[core] = 0;
+    if (entry.owner == INT32(core))
+        entry.owner = -1;
+
+    if (entry.sharers != 0)
+        return;
+
+    // keep lines around that still have to classify a coherence miss
+    if (entry.invalidated == 0)
+        directory->_entries.erase(it);
+    else
+    {
+        directory->_unheld.push_back(line);
+        directory->AgeOut();
+    }
+}
+
+template <class CACHE_T>
+VOID DIRECTORY<CACHE_T>::AgeOut()
+{
+    while (_unheld.size() > _maxUnheld)
+    {
+        // a line held again since is left alone
+        typename std::unordered_map<ADDRINT, DIRECTORY_ENTRY>::iterator it = _entries.find(_unheld.front());
+        _unheld.pop_front();
+
+        if (it != _entries.end() && it->second.sharers == 0)
+        {
+            _entries.erase(it);
+            _agedOut++;
+        }
+    }
+}
+
+/*!
+ *  @brief Stats output method
+ */
+template <class CACHE_T>
+string DIRECTORY<CACHE_T>::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + "Directory:\n";
+    out += prefix + ljstr("Invalidations:   ", headerWidth)
+           + mydecstr(_invalidations, numberWidth) + "\n";
+    out += prefix + ljstr("False-Sharing:   ", headerWidth)
+           + mydecstr(_falseSharing, numberWidth) +
+           "  " +fltstr(_invalidations ? 100.0 * _falseSharing / _invalidations : 0.0, 2, 6) + "%\n";
+    out += prefix + ljstr("Upgrades:        ", headerWidth)
+           + mydecstr(_upgrades, numberWidth) + "\n";
+    out += prefix + ljstr("Downgrades:      ", headerWidth)
+           + mydecstr(_downgrades, numberWidth) + "\n";
+    out += prefix + ljstr("Coherence-Misses:", headerWidth)
+           + mydecstr(_coherenceMisses, numberWidth) + "\n";
+    out += prefix + ljstr("Tracked-Lines:   ", headerWidth)
+           + mydecstr(_entries.size(), numberWidth) + "\n";
+    out += prefix + ljstr("Aged-Out:        ", headerWidth)
+           + mydecstr(_agedOut, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_COHERENCE_H
@@ -0,0 +1,558 @@
+/*! @file
+ *  This file contains the compressed last level cache
+ */
+
+#ifndef PIN_COMPRESS_H
+#define PIN_COMPRESS_H
+
+#include "dcache.h"
+
+#define COMPRESS_MAX_LINE 256
+#define COMPRESS_SEGMENT_SIZE 8     // bytes of data array a compressed line is made of
+#define COMPRESS_TAG_FACTOR 2       // tags per set over the uncompressed associativity
+
+typedef enum
+{
+    COMPRESS_ZERO,              // all zero, the tag alone
+    COMPRESS_BDI,               // base-delta-immediate
+    COMPRESS_FPC,               // frequent pattern compression
+    COMPRESS_NONE,
+    COMPRESS_NUM
+} COMPRESS_SCHEME;
+
+static const char * const COMPRESS_SCHEME_NAME[COMPRESS_NUM] = { "Zero", "BDI", "FPC", "Uncompressed" };
+
+/// Element i of size bytes, sign extended
+static INT64 CompressElement(const UINT8 * line, UINT32 i, UINT32 size)
+{
+    UINT64 value = 0;
+    memcpy(&value, line + i * size, size);
+
+    const UINT32 shift = 64 - 8 * size;
+    return INT64(value << shift) >> shift;
+}
+
+/// value fits into a sign extended field of bytes
+static bool CompressFits(INT64 value, UINT32 bytes)
+{
+    const INT64 limit = INT64(1) << (8 * bytes - 1);
+    return value >= -limit && value < limit;
+}
+
+/*!
+ *  @brief Size of the line under base-delta-immediate compression
+ *
+ *  Zero lines and lines of one repeated 8 byte value are special cases.
+ *  Otherwise the line is cut into elements of 8, 4 or 2 bytes and every
+ *  element has to be a small delta off one base or off zero (the
+ *  immediate); a bit per element tells which. The best fitting base and
+ *  delta sizes win, the line size if none fits.
+ */
+UINT32 BdiCompressedSize(const UINT8 * line, UINT32 lineSize)
+{
+    const INT64 first = CompressElement(line, 0, 8);
+    bool zero = true;
+    bool repeated = true;
+    for (UINT32 i = 0; i < lineSize / 8; i++)
+    {
+        const INT64 value = CompressElement(line, i, 8);
+        zero &= (value == 0);
+        repeated &= (value == first);
+    }
+    if (zero)
+        return 1;
+    if (repeated)
+        return 8;
+
+    static const UINT32 config[][2] = { {8, 1}, {8, 2}, {8, 4}, {4, 1}, {4, 2}, {2, 1} };
+
+    UINT32 best = lineSize;
+    for (UINT32 c = 0; c < sizeof(config) / sizeof(config[0]); c++)
+    {
+        const UINT32 baseSize = config[c][0];
+        const UINT32 deltaSize = config[c][1];
+        const UINT32 elements = lineSize / baseSize;
+
+        bool fits = true;
+        bool haveBase = false;
+        INT64 base = 0;
+        for (UINT32 i = 0; i < elements && fits; i++)
+        {
+            const INT64 value = CompressElement(line, i, baseSize);
+            if (CompressFits(value, deltaSize))
+                continue;
+            if (!haveBase)
+            {
+                base = value;
+                haveBase = true;
+            }
+            fits = CompressFits(value - base, deltaSize);
+        }
+
+        if (fits)
+            best = std::min(best, baseSize + elements * deltaSize + (elements + 7) / 8);
+    }
+
+    return best;
+}
+
+/*!
+ *  @brief Size of the line under frequent pattern compression
+ *
+ *  Every 32 bit word gets a 3 bit prefix and the payload of the first
+ *  pattern it matches: a run of up to 8 zero words, a sign extended 4, 8
+ *  or 16 bit value, a word of one repeated byte, a halfword padded with
+ *  zeros, two sign extended bytes in halfwords, or the whole word.
+ */
+UINT32 FpcCompressedSize(const UINT8 * line, UINT32 lineSize)
+{
+    const UINT32 words = lineSize / 4;
+    UINT32 bits = 0;
+
+    UINT32 i = 0;
+    while (i < words)
+    {
+        UINT32 word;
+        memcpy(&word, line + 4 * i, 4);
+        const INT32 value = INT32(word);
+
+        bits += 3;
+        i++;
+
+        if (word == 0)
+        {
+            UINT32 run = 1;
+            UINT32 next;
+            while (run < 8 && i < words && (memcpy(&next, line + 4 * i, 4), next == 0))
+            {
+                run++;
+                i++;
+            }
+            bits += 3;
+            continue;
+        }
+
+        const INT16 high = INT16(word >> 16);
+        const INT16 low = INT16(word & 0xffff);
+
+        if (value >= -8 && value < 8)
+            bits += 4;
+        else if (value >= -128 && value < 128)
+            bits += 8;
+        else if (word == (word & 0xff) * 0x01010101U)
+            bits += 8;
+        else if (value >= -32768 && value < 32768)
+            bits += 16;
+        else if (low == 0)
+            bits += 16;
+        else if (high >= -128 && high < 128 && low >= -128 && low < 128)
+            bits += 16;
+        else
+            bits += 32;
+    }
+
+    return std::min(lineSize, (bits + 7) / 8);
+}
+
+/*!
+ *  @brief Last level cache that holds lines compressed by their contents
+ *
+ *  A set has COMPRESS_TAG_FACTOR times as many tags as the uncompressed
+ *  level has ways, and a data array of the uncompressed capacity cut into
+ *  segments. A line takes as many segments as its better compression
+ *  needs; a fill evicts LRU lines until there is a free tag and enough
+ *  segments, so the number of lines a set holds depends on the data.
+ *
+ *  The contents are read with PIN_SafeCopy when a line comes in, on a
+ *  demand miss or an install miss, never on a hit. A line keeps the size
+ *  it came in with when it is written back into from above. In pipelined
+ *  mode the simulator reads the data later than the access happened.
+ *
+ *  An uncompressed level of the same geometry sees the same accesses and
+ *  only counts its memory traffic, for the miss and traffic reduction.
+ *  No exclusive policy, no forwarding and no block observer.
+ */
+class COMPRESSED_CACHE : public CACHE_LEVEL
+{
+private:
+    typedef struct
+    {
+        ADDRINT tag;
+        UINT64 used;            // LRU stamp
+        UINT32 segments;
+        bool valid;
+        bool dirty;
+    } LINE;
+
+    const UINT32 _tagsPerSet;
+    const UINT32 _segmentsPerSet;
+
+    std::vector<LINE> _lines;           // _tagsPerSet per set
+    std::vector<UINT32> _freeSegments;  // per set
+    UINT64 _clock;
+    UINT32 _resident;
+
+    CACHE_LEVEL * const _baseline;
+    CACHE_STATS _baselineMemory;
+
+    CACHE_STATS _reads;
+    CACHE_STATS _unreadable;
+    CACHE_STATS _schemes[COMPRESS_NUM];
+    UINT64 _fillBytes;                  // segment bytes taken by the fills
+    CACHE_STATS _fullFills;             // fills that had to evict
+    UINT64 _residentSum;                // resident lines, summed at those fills
+
+    LINE * Find(UINT32 setIndex, ADDRINT tag);
+    /// Segments the line at addr takes, from its current contents
+    UINT32 Segments(ADDRINT addr);
+    /// Make room for and put in a line of the given size
+    VOID Fill(UINT32 setIndex, ADDRINT tag, UINT32 segments, bool dirty);
+    bool AccessLine(ADDRINT addr, ACCESS_TYPE accessType);
+
+public:
+    /// The uncompressed baseline comes from factory
+    COMPRESSED_CACHE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity,
+                     int hit, int miss, CACHE_FACTORY factory);
+
+    using CACHE_LEVEL::AccessSingleLine;
+
+    bool Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType);
+    bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill);
+    VOID Install(ADDRINT addr, bool dirty);
+    bool Invalidate(ADDRINT addr, bool & dirty);
+    bool Clean(ADDRINT addr);
+
+    string CompressionStatsLong(string prefix = "") const;
+};
+
+COMPRESSED_CACHE::COMPRESSED_CACHE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity,
+                                   int hit, int miss, CACHE_FACTORY factory)
+        : CACHE_LEVEL(name, cacheSize, lineSize, associativity, hit, miss),
+          _tagsPerSet(associativity * COMPRESS_TAG_FACTOR),
+          _segmentsPerSet(associativity * lineSize / COMPRESS_SEGMENT_SIZE),
+          _clock(0),
+          _resident(0),
+          // no penalties, the baseline must not touch the clock
+          _baseline(factory(name + "uncompressed ", cacheSize, lineSize, associativity, 0, 0)),
+          _baselineMemory(0),
+          _reads(0),
+          _unreadable(0),
+          _fillBytes(0),
+          _fullFills(0),
+          _residentSum(0)
+{
+    ASSERTX(lineSize <= COMPRESS_MAX_LINE && lineSize % COMPRESS_SEGMENT_SIZE == 0);
+
+    LINE empty;
+    memset(&empty, 0, sizeof(empty));
+    _lines.resize(NumSets() * _tagsPerSet, empty);
+    _freeSegments.resize(NumSets(), _segmentsPerSet);
+
+    for (UINT32 scheme = 0; scheme < COMPRESS_NUM; scheme++)
+        _schemes[scheme] = 0;
+
+    _baseline->setMemoryCounter(&_baselineMemory);
+}
+
+COMPRESSED_CACHE::LINE * COMPRESSED_CACHE::Find(UINT32 setIndex, ADDRINT tag)
+{
+    LINE * lines = &_lines[setIndex * _tagsPerSet];
+    for (UINT32 i = 0; i < _tagsPerSet; i++)
+    {
+        if (lines[i].valid && lines[i].tag == tag)
+            return &lines[i];
+    }
+    return NULL;
+}
+
+UINT32 COMPRESSED_CACHE::Segments(ADDRINT addr)
+{
+    const UINT32 lineSize = LineSize();
+    const ADDRINT line = addr & ~ADDRINT(lineSize - 1);
+
+    // the levels above may be virtual, the data is only reachable there
+    ADDRINT vaddr = line;
+    UINT8 data[COMPRESS_MAX_LINE];
+
+    _reads++;
+    if ((!prev_levels.empty() && !prev_levels[0]->FromBelow(line, vaddr)) ||
+        PIN_SafeCopy(data, reinterpret_cast<VOID *>(vaddr), lineSize) != lineSize)
+    {
+        _unreadable++;
+        _schemes[COMPRESS_NONE]++;
+        return lineSize / COMPRESS_SEGMENT_SIZE;
+    }
+
+    const UINT32 bdi = BdiCompressedSize(data, lineSize);
+    const UINT32 fpc = FpcCompressedSize(data, lineSize);
+    const UINT32 size = std::min(bdi, fpc);
+
+    if (size == 1)
+        _schemes[COMPRESS_ZERO]++;
+    else if (size == lineSize)
+        _schemes[COMPRESS_NONE]++;
+    else
+        _schemes[bdi <= fpc ? COMPRESS_BDI : COMPRESS_FPC]++;
+
+    return std::max<UINT32>(1, (size + COMPRESS_SEGMENT_SIZE - 1) / COMPRESS_SEGMENT_SIZE);
+}
+
+VOID COMPRESSED_CACHE::Fill(UINT32 setIndex, ADDRINT tag, UINT32 segments, bool dirty)
+{
+    LINE * lines = &_lines[setIndex * _tagsPerSet];
+    bool evicted = false;
+
+    while (true)
+    {
+        LINE * invalid = NULL;
+        LINE * lru = NULL;
+        for (UINT32 i = 0; i < _tagsPerSet; i++)
+        {
+            if (!lines[i].valid)
+            {
+                if (invalid == NULL)
+                    invalid = &lines[i];
+            }
+            else if (lru == NULL || lines[i].used < lru->used)
+                lru = &lines[i];
+        }
+
+        if (invalid != NULL && _freeSegments[setIndex] >= segments)
+        {
+            invalid->tag = tag;
+            invalid->used = ++_clock;
+            invalid->segments = segments;
+            invalid->valid = true;
+            invalid->dirty = dirty;
+            _freeSegments[setIndex] -= segments;
+            _resident++;
+            break;
+        }
+
+        // the slot is free before the victim goes down, the back
+        // invalidations it causes do not come back here
+        CACHE_TAG victim(lru->tag);
+        victim.SetValid(true);
+        victim.SetDirty(lru->dirty);
+
+        lru->valid = false;
+        _freeSegments[setIndex] += lru->segments;
+        _resident--;
+        evicted = true;
+
+        Evict(victim);
+    }
+
+    _fillBytes += segments * COMPRESS_SEGMENT_SIZE;
+
+    // only a full set tells how much the level holds
+    if (evicted)
+    {
+        _fullFills++;
+        _residentSum += _resident;
+    }
+}
+
+bool COMPRESSED_CACHE::AccessLine(ADDRINT addr, ACCESS_TYPE accessType)
+{
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    SplitAddress(addr, tag, setIndex);
+
+    LINE * line = Find(setIndex, tag);
+    const bool hit = (line != NULL);
+
+    const int penalty = hit ? hit_penalty : miss_penalty;
+    if (penalty != 0)
+        ins_count += penalty;
+
+    if (!hit && miss_listener != NULL)
+        miss_listener(miss_listener_arg, addr, accessType);
+
+    if (hit)
+    {
+        line->used = ++_clock;
+        if (accessType == ACCESS_TYPE_STORE)
+            line->dirty = true;
+        return true;
+    }
+
+    // loads and stores allocate
+    Fill(setIndex, tag, Segments(addr), accessType == ACCESS_TYPE_STORE);
+
+    bool fillDirty;
+    Fetch(addr, accessType, fillDirty);
+    return false;
+}
+
+/*!
+ *  @return true if all accessed cache lines hit
+ */
+bool COMPRESSED_CACHE::Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType)
+{
+    const ADDRINT highAddr = addr + size;
+    const ADDRINT lineSize = LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
+
+    _baseline->Access(addr, size, accessType);
+
+    bool allHit = true;
+    do
+    {
+        allHit &= AccessLine(addr, accessType);
+
+        addr = (addr & notLineMask) + lineSize; // start of next cache line
+    }
+    while (addr < highAddr);
+
+    _access[accessType][allHit]++;
+
+    return allHit;
+}
+
+bool COMPRESSED_CACHE::AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill)
+{
+    _baseline->AccessSingleLine(addr, accessType);
+
+    const bool hit = AccessLine(addr, accessType);
+    dirtyFill = false;
+
+    _access[accessType][hit]++;
+    return hit;
+}
+
+VOID COMPRESSED_CACHE::Install(ADDRINT addr, bool dirty)
+{
+    _baseline->Install(addr, dirty);
+
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    SplitAddress(addr, tag, setIndex);
+
+    LINE * line = Find(setIndex, tag);
+    _install[line != NULL]++;
+
+    if (line != NULL)
+    {
+        line->used = ++_clock;
+        line->dirty |= dirty;
+    }
+    else
+        Fill(setIndex, tag, Segments(addr), dirty);
+}
+
+bool COMPRESSED_CACHE::Invalidate(ADDRINT addr, bool & dirty)
+{
+    bool baselineDirty;
+    _baseline->Invalidate(addr, baselineDirty);
+
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    SplitAddress(addr, tag, setIndex);
+
+    LINE * line = Find(setIndex, tag);
+    dirty = false;
+    if (line != NULL)
+    {
+        dirty = line->dirty;
+        line->valid = false;
+        _freeSegments[setIndex] += line->segments;
+        _resident--;
+        _backInvalidations++;
+        if (evict_listener != NULL)
+            evict_listener(evict_listener_arg, evict_listener_id, RecoverAddress(tag.GetTag()));
+    }
+
+    if (inclusion == CACHE_INCLUSION::INCLUSIVE)
+    {
+        for (size_t i = 0; i < prev_levels.size(); i++)
+        {
+            ADDRINT prevAddr;
+            bool prevDirty;
+            if (prev_levels[i]->FromBelow(addr, prevAddr) &&
+                prev_levels[i]->Invalidate(prevAddr, prevDirty) && prevDirty)
+                dirty = true;
+        }
+    }
+
+    return line != NULL;
+}
+
+bool COMPRESSED_CACHE::Clean(ADDRINT addr)
+{
+    _baseline->Clean(addr);
+
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    SplitAddress(addr, tag, setIndex);
+
+    LINE * line = Find(setIndex, tag);
+    if (line == NULL)
+        return false;
+
+    const bool dirty = line->dirty;
+    line->dirty = false;
+    return dirty;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string COMPRESSED_CACHE::CompressionStatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    const CACHE_STATS fills = _schemes[COMPRESS_ZERO] + _schemes[COMPRESS_BDI] +
+                              _schemes[COMPRESS_FPC] + _schemes[COMPRESS_NONE];
+    const UINT32 lines = CacheSize() / LineSize();
+    // the steady state once sets fill up, what is there if they never did
+    const double resident = _fullFills ? double(_residentSum) / _fullFills : double(_resident);
+
+    const CACHE_STATS misses = Misses();
+    const CACHE_STATS baselineMisses = _baseline->Misses();
+    // every miss reads a line, every dirty victim writes one
+    const CACHE_STATS traffic = misses + Writebacks();
+
+    string out;
+
+    out += prefix + ljstr("Line-Reads:      ", headerWidth)
+           + mydecstr(_reads, numberWidth) + "\n";
+    out += prefix + ljstr("Unreadable:      ", headerWidth)
+           + mydecstr(_unreadable, numberWidth) + "\n";
+    for (UINT32 scheme = 0; scheme < COMPRESS_NUM; scheme++)
+    {
+        out += prefix + ljstr(string(COMPRESS_SCHEME_NAME[scheme]) + ":", headerWidth)
+               + mydecstr(_schemes[scheme], numberWidth) +
+               "  " + fltstr(fills ? 100.0 * _schemes[scheme] / fills : 0.0, 2, 6) + "%\n";
+    }
+    out += prefix + ljstr("Compression:     ", headerWidth)
+           + fltstr(_fillBytes ? double(fills) * LineSize() / _fillBytes : 0.0, 2, numberWidth) + "\n";
+    out += prefix + ljstr("Avg-Resident:    ", headerWidth)
+           + fltstr(resident, 1, numberWidth) + " / " + mydecstr(lines, 0) + "\n";
+    out += prefix + ljstr("Capacity-Gain:   ", headerWidth)
+           + fltstr(resident / lines, 2, numberWidth) + "\n";
+    out += prefix + "\n";
+
+    out += prefix + ljstr("Misses:          ", headerWidth)
+           + mydecstr(misses, numberWidth) + "\n";
+    out += prefix + ljstr("Baseline-Misses: ", headerWidth)
+           + mydecstr(baselineMisses, numberWidth) +
+           "  " + fltstr(baselineMisses ? 100.0 * (INT64(baselineMisses) - INT64(misses)) / baselineMisses : 0.0, 2, 6)
+           + "% saved\n";
+    out += prefix + ljstr("Memory-Lines:    ", headerWidth)
+           + mydecstr(traffic, numberWidth) + "\n";
+    out += prefix + ljstr("Baseline-Lines:  ", headerWidth)
+           + mydecstr(_baselineMemory, numberWidth) +
+           "  " + fltstr(_baselineMemory ? 100.0 * (INT64(_baselineMemory) - INT64(traffic)) / _baselineMemory : 0.0, 2, 6)
+           + "% saved\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_COMPRESS_H
@@ -0,0 +1,393 @@
+/*! @file
+ *  This file contains the attribution of cache misses to data objects
+ */
+
+#ifndef PIN_DATAPROF_H
+#define PIN_DATAPROF_H
+
+#include <map>
+#include <unordered_map>
+
+#include "dcache.h"
+
+#define DATA_MAX_THREADS 1024
+#define DATA_LOOKUP_CACHE 256       // entries, indexed by 4K page
+
+/*!
+ *  @brief A static object or all heap blocks from one allocation site
+ */
+typedef struct
+{
+    string name;
+    CACHE_STATS misses[ACCESS_TYPE_NUM];
+    UINT64 allocations;
+    UINT64 liveBytes;
+    UINT64 peakBytes;               // footprint
+} DATA_OBJECT;
+
+typedef struct
+{
+    ADDRINT start;
+    ADDRINT end;
+    UINT32 object;
+} DATA_INTERVAL;
+
+/*!
+ *  @brief Live heap blocks and static objects of the application, and the
+ *  misses each of them takes in the cache it listens to
+ *
+ *  Static objects are the data symbols of every image, or whole data
+ *  sections without symbols, kept in a sorted array. Heap blocks live in
+ *  an ordered map. Both are fronted by a direct mapped cache of the last
+ *  interval seen per page, so the misses of a hot object rarely go past
+ *  one compare.
+ */
+class DATA_PROFILE
+{
+private:
+    typedef struct
+    {
+        ADDRINT site;
+        UINT64 size;
+        ADDRINT old;                // block a realloc gives up
+        UINT32 depth;               // allocator calls nested in this thread
+    } CALL;
+
+    std::vector<DATA_OBJECT> _objects;  // 0 collects whatever is not attributed
+    std::vector<DATA_INTERVAL> _statics;
+    std::map<ADDRINT, DATA_INTERVAL> _heap;
+    std::unordered_map<ADDRINT, UINT32> _sites;
+    DATA_INTERVAL _lookupCache[DATA_LOOKUP_CACHE];
+    CALL _calls[DATA_MAX_THREADS];
+    PIN_LOCK _lock;
+
+    UINT32 AddObject(string name);
+    static string SiteName(ADDRINT site);
+    UINT32 Lookup(ADDRINT addr);
+    VOID Allocate(ADDRINT site, const string & name, ADDRINT addr, UINT64 size);
+    VOID Free(ADDRINT addr);
+
+public:
+    DATA_PROFILE();
+
+    /// Register the static objects of a newly loaded image
+    VOID AddImage(IMG img);
+    VOID RemoveImage(IMG img);
+
+    // allocator entry and exit, oldBlock is the block a realloc replaces
+    VOID AllocBefore(THREADID tid, ADDRINT site, UINT64 size, ADDRINT oldBlock);
+    VOID AllocAfter(THREADID tid, ADDRINT block);
+    VOID FreeBefore(THREADID tid, ADDRINT block);
+
+    /// Miss listener of the cache
+    static VOID Miss(VOID * v, ADDRINT addr, ACCESS_TYPE accessType);
+
+    string StatsLong(string prefix, UINT32 top) const;
+};
+
+DATA_PROFILE::DATA_PROFILE()
+{
+    AddObject("[unattributed]");
+
+    for (UINT32 i = 0; i < DATA_LOOKUP_CACHE; i++)
+    {
+        _lookupCache[i].start = 0;
+        _lookupCache[i].end = 0;
+        _lookupCache[i].object = 0;
+    }
+    memset(_calls, 0, sizeof(_calls));
+    PIN_InitLock(&_lock);
+}
+
+UINT32 DATA_PROFILE::AddObject(string name)
+{
+    DATA_OBJECT object;
+    object.name = name;
+    object.misses[ACCESS_TYPE_LOAD] = 0;
+    object.misses[ACCESS_TYPE_STORE] = 0;
+    object.allocations = 0;
+    object.liveBytes = 0;
+    object.peakBytes = 0;
+    _objects.push_back(object);
+    return _objects.size() - 1;
+}
+
+static bool IntervalBefore(const DATA_INTERVAL & a, const DATA_INTERVAL & b)
+{
+    return a.start < b.start;
+}
+
+VOID DATA_PROFILE::AddImage(IMG img)
+{
+    const string image = IMG_Name(img).substr(IMG_Name(img).find_last_of('/') + 1);
+
+    std::vector<std::pair<ADDRINT, string> > symbols;
+    for (SYM sym = IMG_RegsymHead(img); SYM_Valid(sym); sym = SYM_Next(sym))
+        symbols.push_back(std::make_pair(SYM_Address(sym), SYM_Name(sym)));
+    std::sort(symbols.begin(), symbols.end());
+
+    PIN_GetLock(&_lock, 1);
+
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    {
+        if (SEC_Type(sec) != SEC_TYPE_DATA && SEC_Type(sec) != SEC_TYPE_BSS)
+            continue;
+
+        const ADDRINT start = SEC_Address(sec);
+        const ADDRINT end = start + SEC_Size(sec);
+        if (start == end)
+            continue;
+
+        // every symbol reaches up to the next one, bytes before the first
+        // symbol belong to the section itself
+        std::vector<std::pair<ADDRINT, string> >::const_iterator it =
+                std::lower_bound(symbols.begin(), symbols.end(), std::make_pair(start, string()));
+
+        ADDRINT from = start;
+        UINT32 object = AddObject(SEC_Name(sec) + " (" + image + ")");
+        for (; it != symbols.end() && it->first < end; ++it)
+        {
+            if (it->first > from)
+            {
+                DATA_INTERVAL interval = { from, it->first, object };
+                _statics.push_back(interval);
+                _objects[object].peakBytes += it->first - from;
+            }
+            from = it->first;
+            object = AddObject(it->second + " (" + image + ")");
+        }
+        DATA_INTERVAL interval = { from, end, object };
+        _statics.push_back(interval);
+        _objects[object].peakBytes += end - from;
+    }
+    std::sort(_statics.begin(), _statics.end(), IntervalBefore);
+
+    PIN_ReleaseLock(&_lock);
+}
+
+VOID DATA_PROFILE::RemoveImage(IMG img)
+{
+    const ADDRINT low = IMG_LowAddress(img);
+    const ADDRINT high = IMG_HighAddress(img);
+
+    PIN_GetLock(&_lock, 1);
+
+    std::vector<DATA_INTERVAL> kept;
+    for (size_t i = 0; i < _statics.size(); i++)
+    {
+        if (_statics[i].start < low || _statics[i].start > high)
+            kept.push_back(_statics[i]);
+    }
+    _statics.swap(kept);
+
+    for (UINT32 i = 0; i < DATA_LOOKUP_CACHE; i++)
+    {
+        if (_lookupCache[i].start >= low && _lookupCache[i].start <= high)
+            _lookupCache[i].end = 0;
+    }
+
+    PIN_ReleaseLock(&_lock);
+}
+
+/*!
+ *  @brief Name of the object collecting the heap blocks allocated at site
+ */
+string DATA_PROFILE::SiteName(ADDRINT site)
+{
+    INT32 column = 0;
+    INT32 line = 0;
+    string file;
+
+    PIN_LockClient();
+    const string function = RTN_FindNameByAddress(site);
+    PIN_GetSourceLocation(site, &column, &line, &file);
+    PIN_UnlockClient();
+
+    string name = "heap@" + (function.empty() ? "0x" + hexstr(site) : function);
+    if (!file.empty())
+        name += " " + file + ":" + decstr(line);
+    return name;
+}
+
+VOID DATA_PROFILE::Allocate(ADDRINT site, const string & name, ADDRINT addr, UINT64 size)
+{
+    if (addr == 0 || size == 0)
+        return;
+
+    UINT32 object;
+    std::unordered_map<ADDRINT, UINT32>::const_iterator it = _sites.find(site);
+    if (it != _sites.end())
+    {
+        object = it->second;
+    }
+    else
+    {
+        object = AddObject(name);
+        _sites[site] = object;
+    }
+    DATA_INTERVAL interval = { addr, addr + size, object };
+    _heap[addr] = interval;
+
+    DATA_OBJECT & o = _objects[object];
+    o.allocations++;
+    o.liveBytes += size;
+    if (o.liveBytes > o.peakBytes)
+        o.peakBytes = o.liveBytes;
+}
+
+VOID DATA_PROFILE::Free(ADDRINT addr)
+{
+    std::map<ADDRINT, DATA_INTERVAL>::iterator it = _heap.find(addr);
+    if (it == _heap.end())
+        return;
+
+    const DATA_INTERVAL & interval = it->second;
+    _objects[interval.object].liveBytes -= interval.end - interval.start;
+
+    // cached copies sit in the slots of the pages the block covers
+    for (ADDRINT page = interval.start >> 12;
+         page <= (interval.end - 1) >> 12 && page - (interval.start >> 12) < DATA_LOOKUP_CACHE;
+         page++)
+    {
+        DATA_INTERVAL & cached = _lookupCache[page % DATA_LOOKUP_CACHE];
+        if (cached.start == interval.start)
+            cached.end = 0;
+    }
+
+    _heap.erase(it);
+}
+
+VOID DATA_PROFILE::AllocBefore(THREADID tid, ADDRINT site, UINT64 size, ADDRINT oldBlock)
+{
+    CALL & call = _calls[tid];
+
+    // calloc and realloc may go through malloc, only the outer call counts
+    if (call.depth++ != 0)
+        return;
+
+    call.site = site;
+    call.size = size;
+    call.old = oldBlock;
+}
+
+VOID DATA_PROFILE::AllocAfter(THREADID tid, ADDRINT block)
+{
+    CALL & call = _calls[tid];
+    if (call.depth == 0 || --call.depth != 0)
+        return;
+
+    // image loads hold the client lock and then take ours, so a new site
+    // is symbolized before our lock is taken
+    PIN_GetLock(&_lock, tid + 1);
+    const bool known = _sites.find(call.site) != _sites.end();
+    PIN_ReleaseLock(&_lock);
+    const string name = known ? string() : SiteName(call.site);
+
+    PIN_GetLock(&_lock, tid + 1);
+    if (call.old != 0 && (block != 0 || call.size == 0))
+        Free(call.old);
+    // mmap reports failure with -1
+    if (block != ADDRINT(-1))
+        Allocate(call.site, name, block, call.size);
+    PIN_ReleaseLock(&_lock);
+}
+
+VOID DATA_PROFILE::FreeBefore(THREADID tid, ADDRINT block)
+{
+    if (_calls[tid].depth != 0 || block == 0)
+        return;
+
+    PIN_GetLock(&_lock, tid + 1);
+    Free(block);
+    PIN_ReleaseLock(&_lock);
+}
+
+/*!
+ *  @return the object holding addr, 0 if there is none; called with the lock held
+ */
+UINT32 DATA_PROFILE::Lookup(ADDRINT addr)
+{
+    DATA_INTERVAL & cached = _lookupCache[(addr >> 12) % DATA_LOOKUP_CACHE];
+    if (addr >= cached.start && addr < cached.end)
+        return cached.object;
+
+    std::map<ADDRINT, DATA_INTERVAL>::const_iterator it = _heap.upper_bound(addr);
+    if (it != _heap.begin())
+    {
+        --it;
+        if (addr < it->second.end)
+        {
+            cached = it->second;
+            return cached.object;
+        }
+    }
+
+    DATA_INTERVAL key = { addr, addr, 0 };
+    std::vector<DATA_INTERVAL>::const_iterator s =
+            std::upper_bound(_statics.begin(), _statics.end(), key, IntervalBefore);
+    if (s != _statics.begin())
+    {
+        --s;
+        if (addr < s->end)
+        {
+            cached = *s;
+            return cached.object;
+        }
+    }
+
+    return 0;
+}
+
+VOID DATA_PROFILE::Miss(VOID * v, ADDRINT addr, ACCESS_TYPE accessType)
+{
+    DATA_PROFILE * profile = static_cast<DATA_PROFILE *>(v);
+
+    PIN_GetLock(&profile->_lock, 1);
+    profile->_objects[profile->Lookup(addr)].misses[accessType]++;
+    PIN_ReleaseLock(&profile->_lock);
+}
+
+static bool MoreMisses(const DATA_OBJECT * a, const DATA_OBJECT * b)
+{
+    return a->misses[ACCESS_TYPE_LOAD] + a->misses[ACCESS_TYPE_STORE] >
+           b->misses[ACCESS_TYPE_LOAD] + b->misses[ACCESS_TYPE_STORE];
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string DATA_PROFILE::StatsLong(string prefix, UINT32 top) const
+{
+    const UINT32 numberWidth = 14;
+
+    std::vector<const DATA_OBJECT *> order;
+    for (size_t i = 0; i < _objects.size(); i++)
+    {
+        if (_objects[i].misses[ACCESS_TYPE_LOAD] + _objects[i].misses[ACCESS_TYPE_STORE] != 0)
+            order.push_back(&_objects[i]);
+    }
+    std::sort(order.begin(), order.end(), MoreMisses);
+    if (top != 0 && order.size() > top)
+        order.resize(top);
+
+    string out;
+
+    out += prefix + ljstr("rank", 6)
+           + "   load:misses  store:misses     footprint   allocations  object\n";
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const DATA_OBJECT & o = *order[i];
+        out += prefix + ljstr(decstr(i + 1), 6)
+               + mydecstr(o.misses[ACCESS_TYPE_LOAD], numberWidth)
+               + mydecstr(o.misses[ACCESS_TYPE_STORE], numberWidth)
+               + mydecstr(o.peakBytes, numberWidth)
+               + mydecstr(o.allocations, numberWidth)
+               + "  " + o.name + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_DATAPROF_H
@@ -40,7 +40,24 @@ END_LEGAL */
 #include <fstream>
 
 #include "dcache.h"
-#include "pin_profile.H"
+#include "tlb.h"
+#include "coherence.h"
+#include "pipeline.h"
+#include "shard.h"
+#include "interval.h"
+#include "livestats.h"
+#include "pcprofile.h"
+#include "dataprof.h"
+#include "codeprof.h"
+#include "bench.h"
+#include "filter.h"
+#include "physmem.h"
+#include "wcbuffer.h"
+#include "prefetch.h"
+#include "deadblock.h"
+#include "compress.h"
+#include "slice.h"
+#include "partition.h"
 
 
 std::ofstream outFile;
@@ -59,12 +76,108 @@ KNOB<UINT32> KnobThresholdHit(KNOB_MODE_WRITEONCE , "pintool",
                               "rh", "100", "only report memops with hit count above threshold");
 KNOB<UINT32> KnobThresholdMiss(KNOB_MODE_WRITEONCE, "pintool",
                                "rm","100", "only report memops with miss count above threshold");
+KNOB<UINT32> KnobThresholdCoherence(KNOB_MODE_WRITEONCE, "pintool",
+                                    "rc","0", "only report memops with invalidation, coherence miss or false sharing count above threshold");
+KNOB<UINT32> KnobProfileTop(KNOB_MODE_WRITEONCE, "pintool",
+                            "top","0", "report only the memops with the most misses (0 for all)");
 KNOB<UINT32> KnobCacheSize(KNOB_MODE_WRITEONCE, "pintool",
                            "c","32", "cache size in kilobytes");
 KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool",
                           "b","32", "cache block size in bytes");
 KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
                                "a","4", "cache associativity (1 for direct mapped)");
+KNOB<UINT32> KnobFastMemory(KNOB_MODE_WRITEONCE, "pintool",
+                            "fm","0", "fast memory tier capacity in megabytes (0 disables tiering)");
+KNOB<UINT32> KnobSlowLatency(KNOB_MODE_WRITEONCE, "pintool",
+                             "sl","0", "extra latency of a slow memory tier access");
+KNOB<UINT32> KnobMigrationLimit(KNOB_MODE_WRITEONCE, "pintool",
+                                "mig","0", "max pages promoted to the fast tier per epoch (0 for unlimited)");
+KNOB<BOOL>   KnobDtlb(KNOB_MODE_WRITEONCE, "pintool",
+                      "dtlb","0", "simulate the data TLBs and page walks");
+KNOB<UINT32> KnobPageSize(KNOB_MODE_WRITEONCE, "pintool",
+                          "pg","4", "data page size in kilobytes (4, 2048 or 1048576), one size for all pages of a run");
+KNOB<UINT32> KnobDtlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+                             "dtlb_e","64", "L1 DTLB entries for 4K pages");
+KNOB<UINT32> KnobDtlbAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+                                   "dtlb_a","4", "L1 DTLB associativity for 4K pages");
+KNOB<UINT32> KnobStlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+                             "stlb_e","1536", "STLB entries");
+KNOB<UINT32> KnobStlbAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+                                   "stlb_a","12", "STLB associativity");
+KNOB<UINT32> KnobPdeCacheEntries(KNOB_MODE_WRITEONCE, "pintool",
+                                 "pde_e","32", "page directory entry cache entries (0 disables)");
+KNOB<UINT32> KnobStlbPenalty(KNOB_MODE_WRITEONCE, "pintool",
+                             "stlb_p","7", "cycles an L1 DTLB miss spends looking up the STLB");
+KNOB<BOOL>   KnobICache(KNOB_MODE_WRITEONCE, "pintool",
+                        "icache","0", "simulate an L1 instruction cache sharing L2 with the data cache");
+KNOB<UINT32> KnobICacheSize(KNOB_MODE_WRITEONCE, "pintool",
+                            "ic","32", "instruction cache size in kilobytes");
+KNOB<UINT32> KnobICacheAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+                                     "ia","8", "instruction cache associativity");
+KNOB<string> KnobL2Inclusion(KNOB_MODE_WRITEONCE, "pintool",
+                             "l2_incl","nine", "L2 inclusion policy: nine, inclusive or exclusive");
+KNOB<UINT32> KnobCores(KNOB_MODE_WRITEONCE, "pintool",
+                       "cores","1", "simulated cores with a private L1 each, kept coherent with MESI; "
+                       "application thread t runs on core t % cores");
+KNOB<BOOL>   KnobPipeline(KNOB_MODE_WRITEONCE, "pintool",
+                          "pipe","0", "application threads only log accesses, an internal thread simulates them");
+KNOB<UINT32> KnobL2Shards(KNOB_MODE_WRITEONCE, "pintool",
+                          "l2_shards","1", "worker threads simulating disjoint L2 set slices, "
+                          "without L2 timing feedback (1 disables)");
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+                          "interval","0", "write interval statistics every that many instructions or accesses (0 disables)");
+KNOB<string> KnobIntervalUnit(KNOB_MODE_WRITEONCE, "pintool",
+                              "interval_unit","ins", "interval length counts ins (instructions) or acc (L1 data cache accesses)");
+KNOB<string> KnobIntervalFile(KNOB_MODE_WRITEONCE, "pintool",
+                              "interval_o","dcache.interval.csv", "interval statistics file, JSON lines if it ends in .jsonl");
+KNOB<string> KnobLiveStats(KNOB_MODE_WRITEONCE, "pintool",
+                           "live","", "shared statistics page for statsview, e.g. /dev/shm/dcache.stats (empty disables)");
+KNOB<UINT64> KnobLiveEpoch(KNOB_MODE_WRITEONCE, "pintool",
+                           "live_epoch","10000000", "instructions between updates of the shared statistics page");
+KNOB<BOOL>   KnobSelfProfile(KNOB_MODE_WRITEONCE, "pintool",
+                             "selfprof","0", "report the cycles the tool spends in its own hot paths");
+KNOB<BOOL>   KnobDataObjects(KNOB_MODE_WRITEONCE, "pintool",
+                             "objects","0", "attribute L2 misses to heap allocation sites and static objects");
+KNOB<BOOL>   KnobCodeProfile(KNOB_MODE_WRITEONCE, "pintool",
+                             "code","0", "aggregate the memop profile per image and routine");
+KNOB<UINT32> KnobContextDepth(KNOB_MODE_WRITEONCE, "pintool",
+                              "ctx_depth","0", "deepest calling context kept with -code (0 disables the tree)");
+KNOB<UINT64> KnobBench(KNOB_MODE_WRITEONCE, "pintool",
+                       "bench","0", "run this many accesses of each synthetic stream through the cache core, check them and exit (0 runs the application)");
+KNOB<string> KnobFilterImage(KNOB_MODE_APPEND, "pintool",
+                             "filter_img","", "only simulate code of images whose name contains this, main for the executable (repeatable)");
+KNOB<string> KnobFilterRoutine(KNOB_MODE_APPEND, "pintool",
+                               "filter_rtn","", "only simulate code of this routine (repeatable)");
+KNOB<BOOL>   KnobNoStack(KNOB_MODE_WRITEONCE, "pintool",
+                         "no_stack","0", "do not simulate stack and frame pointer relative operands");
+KNOB<string> KnobFilterRange(KNOB_MODE_APPEND, "pintool",
+                             "filter_range","", "only simulate accesses in start:end or start+length, hex (repeatable)");
+KNOB<string> KnobPhysical(KNOB_MODE_WRITEONCE, "pintool",
+                          "phys","", "give the levels below L1 physical addresses from a first touch allocator: seq, random or color");
+KNOB<UINT32> KnobPhysicalSize(KNOB_MODE_WRITEONCE, "pintool",
+                              "phys_mb","16384", "simulated physical memory in megabytes");
+KNOB<string> KnobHugePages(KNOB_MODE_WRITEONCE, "pintool",
+                           "thp","never", "transparent 2M pages with -phys: never, always (at first touch) or collapse");
+KNOB<UINT32> KnobCollapseThreshold(KNOB_MODE_WRITEONCE, "pintool",
+                                   "thp_collapse","256", "4K pages touched in a 2M region before it is collapsed");
+KNOB<UINT32> KnobWcEntries(KNOB_MODE_WRITEONCE, "pintool",
+                           "wc","10", "write-combining buffers for non-temporal stores (0 simulates them as normal stores)");
+KNOB<BOOL>   KnobDeadBlocks(KNOB_MODE_WRITEONCE, "pintool",
+                            "deadblocks","0", "follow every L2 line and report the instructions whose fills are never reused");
+KNOB<BOOL>   KnobCompress(KNOB_MODE_WRITEONCE, "pintool",
+                          "llc_compress","0", "hold L2 lines compressed (BDI/FPC) by their contents, compare with an uncompressed L2");
+KNOB<UINT32> KnobSlices(KNOB_MODE_WRITEONCE, "pintool",
+                        "llc_slices","1", "split L2 into this many slices on a mesh (power of two)");
+KNOB<string> KnobSliceHash(KNOB_MODE_WRITEONCE, "pintool",
+                           "llc_hash","xor", "slice selection of a sliced L2: mod, xor or mix");
+KNOB<UINT32> KnobHopLatency(KNOB_MODE_WRITEONCE, "pintool",
+                            "llc_hop","1", "cycles per mesh hop from a core to an L2 slice, each way");
+KNOB<string> KnobCatMask(KNOB_MODE_APPEND, "pintool",
+                         "cat_mask","", "L2 ways class:mask (hex) may fill, class 0 to 15 (repeatable)");
+KNOB<string> KnobCatThread(KNOB_MODE_APPEND, "pintool",
+                           "cat_thread","", "put thread tid:class in an L2 class of service (repeatable)");
+KNOB<string> KnobCatRoutine(KNOB_MODE_APPEND, "pintool",
+                            "cat_rtn","", "put accesses of routine:class in an L2 class of service, before the thread's (repeatable)");
 
 /* ===================================================================== */
 /* Print Help Message                                                    */
@@ -96,26 +209,69 @@ namespace DL1
 
     //typedef CACHE_ROUND_ROBIN(max_sets, max_associativity, allocation) CACHE;
     typedef CACHE_LRU(max_sets, max_associativity, allocation) CACHE;
+
+    /// Fixed geometry instantiation if there is one, CACHE otherwise
+    CACHE_LEVEL * Create(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
+    {
+        return CreateCache<CACHE, allocation>(name, cacheSize, lineSize, associativity, hit, miss);
+    }
+
+    /// Always CACHE, the benchmark compares it with the fixed geometries
+    CACHE_LEVEL * CreateGeneric(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
+    {
+        return new CACHE(name, cacheSize, lineSize, associativity, hit, miss);
+    }
 }
 
-DL1::CACHE*  dl1 = NULL;
-DL1::CACHE*  l2  = NULL;
+CACHE_LEVEL* dl1 = NULL;
+CACHE_LEVEL* il1 = NULL;
+CACHE_LEVEL* l2  = NULL;
+TLB*         dtlb = NULL;
+
+// per core private levels; core 0 is dl1/dtlb
+UINT32       numCores = 1;
+CACHE_LEVEL* dl1s[MAX_COHERENT_CORES];
+TLB*         dtlbs[MAX_COHERENT_CORES];
+DIRECTORY<CACHE_LEVEL>* directory = NULL;
+PIN_LOCK     coreLock;
+
+PIPELINE*    pipeline = NULL;
+CACHE_SHARDS<CACHE_LEVEL>* l2Shards = NULL;
+INTERVAL_STATS* intervals = NULL;
+LIVE_STATS*  liveStats = NULL;
+DATA_PROFILE* dataProfile = NULL;
+ACCESS_FILTER accessFilter;
+PHYSICAL_MEMORY* physicalMemory = NULL;
+WC_BUFFER*   wcBuffer = NULL;
+SOFTWARE_PREFETCH* swPrefetch = NULL;
+DEAD_BLOCKS* deadBlocks = NULL;
+COMPRESSED_CACHE* compressedL2 = NULL;
+CACHE_SLICES* llcSlices = NULL;
+CACHE_PARTITION* wayPartition = NULL;
 
 typedef enum
 {
     COUNTER_MISS = 0,
     COUNTER_HIT = 1,
+    COUNTER_INVALIDATION,       // remote copies this instruction's stores invalidated
+    COUNTER_COHERENCE_MISS,
+    COUNTER_FALSE_SHARING,      // invalidations of copies that used none of the stored bytes
+    COUNTER_L2_MISS,            // L2 misses on behalf of the instruction
+    COUNTER_L2_WRITEBACK,
     COUNTER_NUM
 } COUNTER;
 
 
-
-typedef  COUNTER_ARRAY<UINT64, COUNTER_NUM> COUNTER_HIT_MISS;
-
-
 VOID docount()
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_DOCOUNT);
+
     ins_count++;
+    retired_count++;
+    if (intervals != NULL)
+        intervals->Check();
+    if (liveStats != NULL)
+        liveStats->Check();
     if( ( (ins_count%EPOCH)==0 ) & (ins_count>WARMUP) )
     {
         cerr << "$$$$ " << ins_count << " memory access = "
@@ -133,57 +289,182 @@ VOID docount()
 
 // holds the counters with misses and hits
 // conceptually this is an array indexed by instruction address
-COMPRESSOR_COUNTER<ADDRINT, UINT32, COUNTER_HIT_MISS> profile;
+PC_PROFILE<COUNTER_NUM> profile;
+
+CODE_PROFILE<COUNTER_NUM>* codeProfile = NULL;
+
+/*!
+ *  Count one profiled access. l2Misses and l2Writebacks are the L2 counters
+ *  from before the access.
+ */
+VOID Account(THREADID tid, UINT32 instId, BOOL hit, CACHE_STATS l2Misses, CACHE_STATS l2Writebacks)
+{
+    const COUNTER counter = hit ? COUNTER_HIT : COUNTER_MISS;
+    // a sharded L2 is simulated later, its counters have nothing to do
+    // with this access
+    if (l2Shards != NULL)
+    {
+        l2Misses = 0;
+        l2Writebacks = 0;
+    }
+    else
+    {
+        l2Misses = l2->Misses() - l2Misses;
+        l2Writebacks = l2->Writebacks() - l2Writebacks;
+    }
+
+    UINT64 * row = profile.Row(tid, instId);
+    row[counter]++;
+    row[COUNTER_L2_MISS] += l2Misses;
+    row[COUNTER_L2_WRITEBACK] += l2Writebacks;
+
+    if (codeProfile != NULL && codeProfile->Contexts())
+    {
+        row = codeProfile->Context(tid);
+        row[counter]++;
+        row[COUNTER_L2_MISS] += l2Misses;
+        row[COUNTER_L2_WRITEBACK] += l2Writebacks;
+    }
+}
+
+/* ===================================================================== */
+
+VOID PageWalk(UINT32 core, ADDRINT addr)
+{
+    ADDRINT pte[TLB_MAX_WALK];
+    const UINT32 refs = dtlbs[core]->Translate(addr, pte);
+    if (refs == 0)
+        return;
+
+    // the walker reads through the data cache; every L1 miss goes on to
+    // L2, whatever reaches memory while it runs is walk-induced traffic
+    const CACHE_STATS memBefore = mem_count_before_warmup + mem_count_after_warmup;
+
+    UINT32 l1Hits = 0;
+    for (UINT32 i = 0; i < refs; i++)
+    {
+        l1Hits += dl1s[core]->AccessSingleLine(pte[i], ACCESS_TYPE_LOAD);
+    }
+
+    dtlbs[core]->AccountWalk(l1Hits, refs - l1Hits,
+                             mem_count_before_warmup + mem_count_after_warmup - memBefore);
+}
+
+VOID Translate(UINT32 core, ADDRINT addr, UINT32 size)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_TRANSLATE);
+
+    PageWalk(core, addr);
+
+    // an access may straddle two pages
+    const UINT32 pageShift = TLB_PAGE_SHIFT[dtlb->PageSize()];
+    const ADDRINT lastAddr = addr + size - 1;
+    if ((lastAddr >> pageShift) != (addr >> pageShift))
+        PageWalk(core, lastAddr);
+}
 
 /* ===================================================================== */
  
-VOID LoadMulti(ADDRINT addr, UINT32 size, UINT32 instId)
+VOID LoadMulti(THREADID tid, ADDRINT addr, UINT32 size, UINT32 instId)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_LOAD);
+
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
     // first level D-cache
     const BOOL dl1Hit = dl1->Access(addr, size, /*CACHE_BASE::*/ACCESS_TYPE_LOAD);
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+    Account(tid, instId, dl1Hit, l2Misses, l2Writebacks);
 }
 
 /* ===================================================================== */
 
-VOID StoreMulti(ADDRINT addr, UINT32 size, UINT32 instId)
+VOID StoreMulti(THREADID tid, ADDRINT addr, UINT32 size, UINT32 instId)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_STORE);
+
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
     // first level D-cache
     const BOOL dl1Hit = dl1->Access(addr, size, /*CACHE_BASE::*/ACCESS_TYPE_STORE);
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+    Account(tid, instId, dl1Hit, l2Misses, l2Writebacks);
 }
 
 /* ===================================================================== */
 
-VOID LoadSingle(ADDRINT addr, UINT32 instId)
+VOID LoadSingle(THREADID tid, ADDRINT addr, UINT32 size, UINT32 instId)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_LOAD);
+
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
     // @todo we may access several cache lines for
     // first level D-cache
     const BOOL dl1Hit = dl1->AccessSingleLine(addr, /*CACHE_BASE::*/ACCESS_TYPE_LOAD);
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+    Account(tid, instId, dl1Hit, l2Misses, l2Writebacks);
 }
 /* ===================================================================== */
 
-VOID StoreSingle(ADDRINT addr, UINT32 instId)
+VOID StoreSingle(THREADID tid, ADDRINT addr, UINT32 size, UINT32 instId)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_STORE);
+
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
     // @todo we may access several cache lines for
     // first level D-cache
     const BOOL dl1Hit = dl1->AccessSingleLine(addr, /*CACHE_BASE::*/ACCESS_TYPE_STORE);
 
-    const COUNTER counter = dl1Hit ? COUNTER_HIT : COUNTER_MISS;
-    profile[instId][counter]++;
+    Account(tid, instId, dl1Hit, l2Misses, l2Writebacks);
 }
 
 /* ===================================================================== */
 
 VOID LoadMultiFast(ADDRINT addr, UINT32 size)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_LOAD);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
     dl1->Access(addr, size, /*CACHE_BASE::*/ACCESS_TYPE_LOAD);
 }
 
@@ -191,212 +472,1588 @@ VOID LoadMultiFast(ADDRINT addr, UINT32 size)
 
 VOID StoreMultiFast(ADDRINT addr, UINT32 size)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_STORE);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
     dl1->Access(addr, size, /*CACHE_BASE::*/ACCESS_TYPE_STORE);
 }
 
 /* ===================================================================== */
 
-VOID LoadSingleFast(ADDRINT addr)
+VOID LoadSingleFast(ADDRINT addr, UINT32 size)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_LOAD);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
     dl1->AccessSingleLine(addr, /*CACHE_BASE::*/ACCESS_TYPE_LOAD);
 }
 
 /* ===================================================================== */
 
-VOID StoreSingleFast(ADDRINT addr)
+VOID StoreSingleFast(ADDRINT addr, UINT32 size)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_STORE);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
     dl1->AccessSingleLine(addr, /*CACHE_BASE::*/ACCESS_TYPE_STORE);
 }
 
+/* ===================================================================== */
+
+VOID StreamStore(THREADID tid, ADDRINT addr, UINT32 size, UINT32 instId)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_STORE);
+
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    if (dtlb != NULL)
+        Translate(0, addr, size);
+
+    wcBuffer->Store(addr, size);
+}
+
+VOID Fence()
+{
+    wcBuffer->Fence();
+}
+
+VOID Prefetch(THREADID tid, ADDRINT addr, UINT32 hint, UINT32 instId)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_LOAD);
+
+    if (deadBlocks != NULL)
+        deadBlocks->SetSource(DEAD_BLOCK_PREFETCH);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    // a prefetch only fetches the line of addr, it never touches the next page
+    if (dtlb != NULL)
+        Translate(0, addr, 1);
 
+    swPrefetch->Prefetch(addr, PREFETCH_HINT(hint));
+}
 
 /* ===================================================================== */
 
-VOID Instruction(INS ins, void * v)
+#define MAX_MULTI_LINES 64
+
+typedef BOOL (*LINE_ACCESS)(THREADID tid, ADDRINT line, ACCESS_TYPE accessType, UINT32 instId);
+
+BOOL AccessLine(THREADID tid, ADDRINT line, ACCESS_TYPE accessType, UINT32 instId)
 {
+    if (dtlb != NULL)
+        Translate(0, line, 1);
 
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
+    return dl1->AccessSingleLine(line, accessType);
+}
+
+/*!
+ *  @return true if the element is accessed: not masked off and, with
+ *  address ranges, starting inside one of them
+ */
+BOOL MultiMemElement(const PIN_MEM_ACCESS_INFO & memop)
+{
+    if (!memop.maskOn || memop.bytesToAccess == 0)
+        return false;
+
+    return !accessFilter.HasRanges() || ACCESS_FILTER::InRanges(&accessFilter, memop.memoryAddress);
+}
 
-    if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
+/*!
+ *  @return true if no element of the operand is accessed, the instruction
+ *  is then left out like a filtered standard memop
+ */
+BOOL MultiMemFiltered(PIN_MULTI_MEM_ACCESS_INFO * info)
+{
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
     {
-        // map sparse INS addresses to dense IDs
-        const ADDRINT iaddr = INS_Address(ins);
-        const UINT32 instId = profile.Map(iaddr);
+        if (MultiMemElement(info->memop[i]))
+            return false;
+    }
+    return true;
+}
 
-        const UINT32 size = INS_MemoryReadSize(ins);
-        const BOOL   single = (size <= 4);
+/*!
+ *  Gathers, scatters and other non-standard memory operands. Masked-off
+ *  and filtered elements are skipped and elements that fall into the same
+ *  cache line with the same access type are coalesced into a single access.
+ *  @return true if all accessed cache lines hit
+ */
+BOOL MultiMemAccess(THREADID tid, PIN_MULTI_MEM_ACCESS_INFO * info, UINT32 instId, LINE_ACCESS accessLine)
+{
+    const ADDRINT lineSize = dl1->LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
 
-        if( KnobTrackLoads )
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE, (AFUNPTR) LoadSingle,
-                        IARG_MEMORYREAD_EA,
-                        IARG_UINT32, instId,
-                        IARG_END);
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) LoadMulti,
-                        IARG_MEMORYREAD_EA,
-                        IARG_MEMORYREAD_SIZE,
-                        IARG_UINT32, instId,
-                        IARG_END);
-            }
+    ADDRINT lines[MAX_MULTI_LINES];
+    ACCESS_TYPE types[MAX_MULTI_LINES];
+    UINT32 numLines = 0;
+    BOOL allHit = true;
 
-        }
-        else
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
+    {
+        const PIN_MEM_ACCESS_INFO & memop = info->memop[i];
+        if (!MultiMemElement(memop))
+            continue;
+
+        const ACCESS_TYPE accessType = (memop.memopType == PIN_MEMOP_STORE) ? ACCESS_TYPE_STORE : ACCESS_TYPE_LOAD;
+        const ADDRINT last = (memop.memoryAddress + memop.bytesToAccess - 1) & notLineMask;
+
+        // an unaligned element may straddle two lines
+        for (ADDRINT line = memop.memoryAddress & notLineMask; line <= last; line += lineSize)
         {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) LoadSingleFast,
-                        IARG_MEMORYREAD_EA,
-                        IARG_END);
+            UINT32 j = 0;
+            while (j < numLines && (lines[j] != line || types[j] != accessType))
+                j++;
 
-            }
-            else
+            if (j < numLines)
+                continue;
+
+            if (numLines == MAX_MULTI_LINES)
             {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) LoadMultiFast,
-                        IARG_MEMORYREAD_EA,
-                        IARG_MEMORYREAD_SIZE,
-                        IARG_END);
+                // too many distinct lines to remember, stop coalescing this one
+                allHit &= accessLine(tid, line, accessType, instId);
+                continue;
             }
+            lines[numLines] = line;
+            types[numLines] = accessType;
+            numLines++;
         }
     }
 
-    if ( INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+    for (UINT32 j = 0; j < numLines; j++)
     {
-        // map sparse INS addresses to dense IDs
-        const ADDRINT iaddr = INS_Address(ins);
-        const UINT32 instId = profile.Map(iaddr);
+        allHit &= accessLine(tid, lines[j], types[j], instId);
+    }
 
-        const UINT32 size = INS_MemoryWriteSize(ins);
+    return allHit;
+}
 
-        const BOOL   single = (size <= 4);
+/* ===================================================================== */
 
-        if( KnobTrackStores )
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingle,
-                        IARG_MEMORYWRITE_EA,
-                        IARG_UINT32, instId,
-                        IARG_END);
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) StoreMulti,
-                        IARG_MEMORYWRITE_EA,
-                        IARG_MEMORYWRITE_SIZE,
-                        IARG_UINT32, instId,
-                        IARG_END);
-            }
+VOID MultiMem(THREADID tid, PIN_MULTI_MEM_ACCESS_INFO * info, UINT32 instId)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_MULTI_MEM);
 
-        }
-        else
-        {
-            if( single )
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) StoreSingleFast,
-                        IARG_MEMORYWRITE_EA,
-                        IARG_END);
+    if (MultiMemFiltered(info))
+        return;
 
-            }
-            else
-            {
-                INS_InsertPredicatedCall(
-                        ins, IPOINT_BEFORE,  (AFUNPTR) StoreMultiFast,
-                        IARG_MEMORYWRITE_EA,
-                        IARG_MEMORYWRITE_SIZE,
-                        IARG_END);
-            }
-        }
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
 
-    }
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
+    const BOOL dl1Hit = MultiMemAccess(tid, info, instId, AccessLine);
+
+    Account(tid, instId, dl1Hit, l2Misses, l2Writebacks);
 }
 
 /* ===================================================================== */
 
-VOID Fini(int code, VOID * v)
+VOID MultiMemFast(PIN_MULTI_MEM_ACCESS_INFO * info)
 {
-    // print D-cache profile
-    // @todo what does this print
+    SELF_PROF_SCOPE prof(SELF_PROF_MULTI_MEM);
 
-    cout <<"trace is done\n";
+    MultiMemAccess(0, info, 0, AccessLine);
+}
 
-    outFile << "PIN:MEMLATENCIES 1.0. 0x0\n";
+/* ===================================================================== */
+/* Multi-core: private L1 per core, MESI directory at L2                 */
+/* ===================================================================== */
 
-    outFile <<
-            "#\n"
-            "# DCACHE stats\n"
-            "#\n";
+BOOL CoherentLine(THREADID tid, UINT32 core, ADDRINT addr, UINT32 size, ACCESS_TYPE accessType, UINT32 instId)
+{
+    UINT32 invalidations;
+    UINT32 falseSharing;
+    const bool coherence = directory->Request(core, addr, size, accessType, invalidations, falseSharing);
 
-    outFile << dl1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    const BOOL hit = dl1s[core]->AccessSingleLine(addr, accessType);
 
-    if( KnobTrackLoads || KnobTrackStores ) {
-        outFile <<
-                "#\n"
-                "# LOAD stats\n"
-                "#\n";
+    if (!hit && coherence)
+    {
+        directory->CoherenceMiss();
+        profile.Row(tid, instId)[COUNTER_COHERENCE_MISS]++;
+    }
+    profile.Row(tid, instId)[COUNTER_INVALIDATION] += invalidations;
+    profile.Row(tid, instId)[COUNTER_FALSE_SHARING] += falseSharing;
 
-        outFile << profile.StringLong();
+    return hit;
+}
+
+VOID CoherentAccess(THREADID tid, ADDRINT addr, UINT32 size, UINT32 accessType, UINT32 instId)
+{
+    SELF_PROF_SCOPE prof(accessType == ACCESS_TYPE_STORE ? SELF_PROF_STORE : SELF_PROF_LOAD);
+
+    PIN_GetLock(&coreLock, tid + 1);
+
+    // the fill source and class are shared by all threads
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
+    const UINT32 core = tid % numCores;
+    if (llcSlices != NULL)
+        llcSlices->SetCore(core);
+    if (dtlb != NULL)
+        Translate(core, addr, size);
+
+    const ADDRINT highAddr = addr + size;
+    const ADDRINT lineSize = dl1->LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
+    BOOL allHit = true;
+    do
+    {
+        const ADDRINT lineEnd = (addr & notLineMask) + lineSize;
+        const ADDRINT end = (highAddr < lineEnd) ? highAddr : lineEnd;
+
+        allHit &= CoherentLine(tid, core, addr, end - addr, ACCESS_TYPE(accessType), instId);
+        addr = lineEnd;
     }
-    outFile.close();
-    fprintf(my_file, "#eof\n");
-    fclose(my_file);
+    while (addr < highAddr);
+
+    Account(tid, instId, allHit, l2Misses, l2Writebacks);
+
+    PIN_ReleaseLock(&coreLock);
+}
+
+BOOL CoherentMultiMemLine(THREADID tid, ADDRINT line, ACCESS_TYPE accessType, UINT32 instId)
+{
+    const UINT32 core = tid % numCores;
+    if (llcSlices != NULL)
+        llcSlices->SetCore(core);
+    if (dtlb != NULL)
+        Translate(core, line, 1);
+
+    return CoherentLine(tid, core, line, dl1->LineSize(), accessType, instId);
+}
+
+VOID CoherentMultiMem(THREADID tid, PIN_MULTI_MEM_ACCESS_INFO * info, UINT32 instId)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_MULTI_MEM);
+
+    if (MultiMemFiltered(info))
+        return;
+
+    PIN_GetLock(&coreLock, tid + 1);
+
+    // the fill source and class are shared by all threads
+    if (deadBlocks != NULL)
+        deadBlocks->SetInstruction(instId);
+    if (wayPartition != NULL)
+        wayPartition->SetAccess(tid, instId);
+
+    const CACHE_STATS l2Misses = l2->Misses();
+    const CACHE_STATS l2Writebacks = l2->Writebacks();
+
+    const BOOL allHit = MultiMemAccess(tid, info, instId, CoherentMultiMemLine);
+
+    Account(tid, instId, allHit, l2Misses, l2Writebacks);
+
+    PIN_ReleaseLock(&coreLock);
 }
 
-/* ===================================================================== */
-/* Main                                                                  */
 /* ===================================================================== */
 
-int main(int argc, char *argv[])
+VOID FetchBlock(THREADID tid, ADDRINT line, UINT32 numLines)
 {
+    SELF_PROF_SCOPE prof(SELF_PROF_FETCH);
 
+    const ADDRINT lineSize = il1->LineSize();
 
-    //myfile.open();
-    PIN_InitSymbols();
+    // the instruction cache shares L2 with all cores
+    if (numCores > 1)
+        PIN_GetLock(&coreLock, tid + 1);
 
+    if (deadBlocks != NULL)
+        deadBlocks->SetSource(DEAD_BLOCK_FETCH);
+    if (wayPartition != NULL)
+        wayPartition->SetThread(tid);
 
-    my_file = fopen("my_trace.out", "w");
+    for (UINT32 i = 0; i < numLines; i++, line += lineSize)
+    {
+        il1->AccessSingleLine(line, ACCESS_TYPE_LOAD);
+    }
 
+    if (numCores > 1)
+        PIN_ReleaseLock(&coreLock);
+}
 
-    if( PIN_Init(argc,argv) )
+/* ===================================================================== */
+/* Pipelined mode: log on the application thread, simulate on our own   */
+/* ===================================================================== */
+
+VOID PipeCount(THREADID tid)
+{
+    pipeline->Count(tid);
+}
+
+VOID PipeAccess(THREADID tid, ADDRINT addr, UINT32 size, UINT32 type, UINT32 instId)
+{
+    pipeline->Push(tid, addr, size, PIPE_RECORD_TYPE(type), instId);
+}
+
+VOID PipeMultiMem(THREADID tid, PIN_MULTI_MEM_ACCESS_INFO * info, UINT32 instId)
+{
+    // elements are replayed one by one, coalescing is left to the caches
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
     {
-        return Usage();
+        const PIN_MEM_ACCESS_INFO & memop = info->memop[i];
+        if (!MultiMemElement(memop))
+            continue;
+
+        const PIPE_RECORD_TYPE type = (memop.memopType == PIN_MEMOP_STORE) ? PIPE_RECORD_STORE : PIPE_RECORD_LOAD;
+        pipeline->Push(tid, memop.memoryAddress, memop.bytesToAccess, type, instId);
     }
+}
 
-    outFile.open(KnobOutputFile.Value().c_str());
+VOID PipeFetch(THREADID tid, ADDRINT line, UINT32 numLines)
+{
+    pipeline->Push(tid, line, numLines, PIPE_RECORD_FETCH, 0);
+}
 
-    //dl1 = new DL1::CACHE("L1 Data Cache",
-    //                     KnobCacheSize.Value() * KILO,
-    //                     KnobLineSize.Value(),
-    //                     KnobAssociativity.Value());
+/*!
+ *  @brief Replay one logged record, runs on the simulator thread
+ */
+VOID SimulateRecord(THREADID tid, const PIPE_RECORD & record)
+{
+    for (UINT32 i = 0; i < record.instructions; i++)
+        docount();
 
-    dl1 = new DL1::CACHE("L1 ",  32*KILO, 64, 4,1,4); //(KnobCacheSize.Value() * KILO,KnobLineSize.Value(),KnobAssociativity.Value());
-    l2  = new DL1::CACHE("L2 ", 1024 * KILO, 64, 8,4,150);
+    switch (record.type)
+    {
+      case PIPE_RECORD_LOAD:
+        if (numCores > 1)
+            CoherentAccess(tid, record.addr, record.size, ACCESS_TYPE_LOAD, record.instId);
+        else
+            LoadMulti(tid, record.addr, record.size, record.instId);
+        break;
 
-    dl1->setNextLevel(l2);
-    l2->setNextLevel(NULL);
+      case PIPE_RECORD_STORE:
+        if (numCores > 1)
+            CoherentAccess(tid, record.addr, record.size, ACCESS_TYPE_STORE, record.instId);
+        else
+            StoreMulti(tid, record.addr, record.size, record.instId);
+        break;
+
+      case PIPE_RECORD_FETCH:
+        FetchBlock(tid, record.addr, record.size);
+        break;
+
+      // with several cores these are plain accesses
+      case PIPE_RECORD_PREFETCH:
+        if (numCores > 1)
+            CoherentAccess(tid, record.addr, 1, ACCESS_TYPE_LOAD, record.instId);
+        else
+            Prefetch(tid, record.addr, record.size, record.instId);
+        break;
 
-    profile.SetKeyName("iaddr          ");
-    profile.SetCounterName("dcache:miss        dcache:hit");
+      case PIPE_RECORD_STREAM:
+        if (numCores > 1)
+            CoherentAccess(tid, record.addr, record.size, ACCESS_TYPE_STORE, record.instId);
+        else
+            StreamStore(tid, record.addr, record.size, record.instId);
+        break;
 
-    COUNTER_HIT_MISS threshold;
+      case PIPE_RECORD_FENCE:
+        if (wcBuffer != NULL)
+            Fence();
+        break;
 
-    threshold[COUNTER_HIT] = KnobThresholdHit.Value();
-    threshold[COUNTER_MISS] = KnobThresholdMiss.Value();
+      default:
+        break;
+    }
+}
 
-    profile.SetThreshold( threshold );
+VOID ThreadStart(THREADID tid, CONTEXT * ctxt, INT32 flags, VOID * v)
+{
+    pipeline->ThreadStart(tid);
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT * ctxt, INT32 code, VOID * v)
+{
+    pipeline->Flush(tid);
+}
+
+VOID PrepareForFini(VOID * v)
+{
+    pipeline->Stop();
+}
+
+VOID ShardsPrepareForFini(VOID * v)
+{
+    l2Shards->Stop();
+}
+
+/* ===================================================================== */
+
+VOID MallocBefore(THREADID tid, ADDRINT site, ADDRINT size)
+{
+    dataProfile->AllocBefore(tid, site, size, 0);
+}
+
+VOID CallocBefore(THREADID tid, ADDRINT site, ADDRINT num, ADDRINT size)
+{
+    dataProfile->AllocBefore(tid, site, UINT64(num) * size, 0);
+}
+
+VOID ReallocBefore(THREADID tid, ADDRINT site, ADDRINT block, ADDRINT size)
+{
+    dataProfile->AllocBefore(tid, site, size, block);
+}
+
+VOID MmapBefore(THREADID tid, ADDRINT site, ADDRINT hint, ADDRINT length)
+{
+    dataProfile->AllocBefore(tid, site, length, 0);
+}
+
+VOID AllocAfter(THREADID tid, ADDRINT block)
+{
+    dataProfile->AllocAfter(tid, block);
+}
+
+VOID FreeBefore(THREADID tid, ADDRINT block)
+{
+    dataProfile->FreeBefore(tid, block);
+}
+
+/*!
+ *  L2 misses come with physical addresses once -phys is on, the objects
+ *  are known by their virtual ones
+ */
+VOID DataMiss(VOID * v, ADDRINT addr, ACCESS_TYPE accessType)
+{
+    if (physicalMemory != NULL && !physicalMemory->Virtual(addr, addr))
+        return;
+    DATA_PROFILE::Miss(v, addr, accessType);
+}
+
+VOID InstrumentAllocator(IMG img, const char * name, AFUNPTR before, UINT32 numArgs)
+{
+    RTN rtn = RTN_FindByName(img, name);
+    if (!RTN_Valid(rtn))
+        return;
+
+    RTN_Open(rtn);
+    if (numArgs == 1)
+        RTN_InsertCall(rtn, IPOINT_BEFORE, before, IARG_THREAD_ID, IARG_RETURN_IP,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+    else
+        RTN_InsertCall(rtn, IPOINT_BEFORE, before, IARG_THREAD_ID, IARG_RETURN_IP,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_END);
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) AllocAfter, IARG_THREAD_ID,
+                   IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+    RTN_Close(rtn);
+}
+
+VOID InstrumentFree(IMG img, const char * name)
+{
+    RTN rtn = RTN_FindByName(img, name);
+    if (!RTN_Valid(rtn))
+        return;
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) FreeBefore, IARG_THREAD_ID,
+                   IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+    RTN_Close(rtn);
+}
+
+VOID ImageLoad(IMG img, VOID * v)
+{
+    dataProfile->AddImage(img);
+
+    InstrumentAllocator(img, "malloc", (AFUNPTR) MallocBefore, 1);
+    InstrumentAllocator(img, "calloc", (AFUNPTR) CallocBefore, 2);
+    InstrumentAllocator(img, "realloc", (AFUNPTR) ReallocBefore, 2);
+    InstrumentAllocator(img, "mmap", (AFUNPTR) MmapBefore, 2);
+    InstrumentFree(img, "free");
+    InstrumentFree(img, "munmap");
+}
+
+VOID ImageUnload(IMG img, VOID * v)
+{
+    dataProfile->RemoveImage(img);
+}
+
+/* ===================================================================== */
+
+VOID EnterRoutine(THREADID tid, UINT32 routine, ADDRINT sp)
+{
+    codeProfile->Enter(tid, routine, sp);
+}
+
+VOID ReturnFromRoutine(THREADID tid, ADDRINT sp)
+{
+    codeProfile->Return(tid, sp);
+}
+
+VOID Routine(RTN rtn, VOID * v)
+{
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) EnterRoutine,
+                   IARG_THREAD_ID,
+                   IARG_UINT32, codeProfile->RoutineId(rtn),
+                   IARG_REG_VALUE, REG_STACK_PTR,
+                   IARG_END);
+    RTN_Close(rtn);
+}
+
+/* ===================================================================== */
+
+/*!
+ *  Instrument a standard memop; with address ranges fun only runs for an
+ *  ea inside one of them
+ */
+#define INSERT_MEMOP_CALL(ins, ea, fun, ...)                                            \
+    do                                                                                  \
+    {                                                                                   \
+        if (accessFilter.HasRanges())                                                   \
+        {                                                                               \
+            INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) ACCESS_FILTER::InRanges, \
+                                       IARG_FAST_ANALYSIS_CALL,                         \
+                                       IARG_PTR, &accessFilter, ea, IARG_END);          \
+            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, fun, __VA_ARGS__);         \
+        }                                                                               \
+        else                                                                            \
+        {                                                                               \
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, fun, __VA_ARGS__);             \
+        }                                                                               \
+    } while (0)
+
+VOID InstructionPipelined(INS ins, BOOL reads, BOOL writes)
+{
+    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) PipeCount, IARG_THREAD_ID, IARG_END);
+
+    if (wcBuffer != NULL && IsStoreFence(ins))
+    {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) PipeAccess,
+                       IARG_THREAD_ID,
+                       IARG_ADDRINT, 0,
+                       IARG_UINT32, 0,
+                       IARG_UINT32, PIPE_RECORD_FENCE,
+                       IARG_UINT32, 0,
+                       IARG_END);
+    }
+
+    if (!reads && !writes)
+        return;
+
+    const UINT32 instId = profile.Map(INS_Address(ins));
+
+    if (!INS_IsStandardMemop(ins))
+    {
+        INS_InsertPredicatedCall(
+                ins, IPOINT_BEFORE,  (AFUNPTR) PipeMultiMem,
+                IARG_THREAD_ID,
+                IARG_MULTI_MEMORYACCESS_EA,
+                IARG_UINT32, instId,
+                IARG_END);
+        return;
+    }
+
+    // prefetches carry their hint in the size field
+    if (reads && INS_IsPrefetch(ins))
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYREAD_EA, (AFUNPTR) PipeAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYREAD_EA,
+                IARG_UINT32, PrefetchHint(ins),
+                IARG_UINT32, PIPE_RECORD_PREFETCH,
+                IARG_UINT32, instId,
+                IARG_END);
+        return;
+    }
+
+    if (reads)
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYREAD_EA, (AFUNPTR) PipeAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYREAD_EA,
+                IARG_MEMORYREAD_SIZE,
+                IARG_UINT32, PIPE_RECORD_LOAD,
+                IARG_UINT32, instId,
+                IARG_END);
+    }
+
+    if (writes)
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYWRITE_EA, (AFUNPTR) PipeAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_UINT32, (wcBuffer != NULL && IsNonTemporalStore(ins)) ? PIPE_RECORD_STREAM
+                                                                           : PIPE_RECORD_STORE,
+                IARG_UINT32, instId,
+                IARG_END);
+    }
+}
+
+/* ===================================================================== */
+
+VOID Trace(TRACE trace, void * v)
+{
+    const ADDRINT lineSize = il1->LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
+
+    // one fetch per cache line a basic block covers, every time it executes
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        const ADDRINT first = BBL_Address(bbl) & notLineMask;
+        const ADDRINT last = (BBL_Address(bbl) + BBL_Size(bbl) - 1) & notLineMask;
+        const UINT32 numLines = (last - first) / lineSize + 1;
+
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) (pipeline != NULL ? PipeFetch : FetchBlock),
+                       IARG_THREAD_ID,
+                       IARG_ADDRINT, first,
+                       IARG_UINT32, numLines,
+                       IARG_END);
+    }
+}
+
+/* ===================================================================== */
+
+VOID InstructionCoherent(INS ins, BOOL reads, BOOL writes)
+{
+    // every memop gets a dense ID, the coherence counters are always kept
+    const ADDRINT iaddr = INS_Address(ins);
+
+    if (!INS_IsStandardMemop(ins))
+    {
+        if (reads || writes)
+        {
+            INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) CoherentMultiMem,
+                    IARG_THREAD_ID,
+                    IARG_MULTI_MEMORYACCESS_EA,
+                    IARG_UINT32, profile.Map(iaddr),
+                    IARG_END);
+        }
+        return;
+    }
+
+    if (reads)
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYREAD_EA, (AFUNPTR) CoherentAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYREAD_EA,
+                IARG_MEMORYREAD_SIZE,
+                IARG_UINT32, ACCESS_TYPE_LOAD,
+                IARG_UINT32, profile.Map(iaddr),
+                IARG_END);
+    }
+
+    if (writes)
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYWRITE_EA, (AFUNPTR) CoherentAccess,
+                IARG_THREAD_ID,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_UINT32, ACCESS_TYPE_STORE,
+                IARG_UINT32, profile.Map(iaddr),
+                IARG_END);
+    }
+}
+
+/* ===================================================================== */
+
+VOID Instruction(INS ins, void * v)
+{
+    // filtered operands get no analysis call at all
+    const BOOL reads = accessFilter.Read(ins);
+    const BOOL writes = accessFilter.Write(ins);
+
+    if (wayPartition != NULL && (reads || writes))
+        wayPartition->MapInstruction(profile.Map(INS_Address(ins)), INS_Rtn(ins));
+
+    if (pipeline != NULL)
+    {
+        if (codeProfile != NULL && (reads || writes))
+            codeProfile->MapInstruction(profile.Map(INS_Address(ins)), INS_Rtn(ins));
+
+        InstructionPipelined(ins, reads, writes);
+        return;
+    }
+
+    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
+
+    if (codeProfile != NULL)
+    {
+        if (reads || writes)
+            codeProfile->MapInstruction(profile.Map(INS_Address(ins)), INS_Rtn(ins));
+
+        if (codeProfile->Contexts() && INS_IsRet(ins))
+        {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) ReturnFromRoutine,
+                           IARG_THREAD_ID,
+                           IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_END);
+        }
+    }
+
+    if (numCores > 1)
+    {
+        InstructionCoherent(ins, reads, writes);
+        return;
+    }
+
+    if (wcBuffer != NULL && IsStoreFence(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) Fence, IARG_END);
+
+    if (reads && INS_IsPrefetch(ins) && INS_IsStandardMemop(ins))
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYREAD_EA, (AFUNPTR) Prefetch,
+                IARG_THREAD_ID,
+                IARG_MEMORYREAD_EA,
+                IARG_UINT32, PrefetchHint(ins),
+                IARG_UINT32, profile.Map(INS_Address(ins)),
+                IARG_END);
+        return;
+    }
+
+    // streaming stores go to the write-combining buffers instead of L1
+    if (writes && wcBuffer != NULL && INS_IsStandardMemop(ins) && IsNonTemporalStore(ins))
+    {
+        INSERT_MEMOP_CALL(
+                ins, IARG_MEMORYWRITE_EA, (AFUNPTR) StreamStore,
+                IARG_THREAD_ID,
+                IARG_MEMORYWRITE_EA,
+                IARG_MEMORYWRITE_SIZE,
+                IARG_UINT32, profile.Map(INS_Address(ins)),
+                IARG_END);
+        return;
+    }
+
+    if (reads && INS_IsStandardMemop(ins))
+    {
+        // map sparse INS addresses to dense IDs
+        const ADDRINT iaddr = INS_Address(ins);
+        const UINT32 instId = profile.Map(iaddr);
+
+        const UINT32 size = INS_MemoryReadSize(ins);
+        const BOOL   single = (size <= 4);
+
+        if( KnobTrackLoads || codeProfile != NULL || deadBlocks != NULL || wayPartition != NULL )
+        {
+            if( single )
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYREAD_EA, (AFUNPTR) LoadSingle,
+                        IARG_THREAD_ID,
+                        IARG_MEMORYREAD_EA,
+                        IARG_UINT32, size,
+                        IARG_UINT32, instId,
+                        IARG_END);
+            }
+            else
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYREAD_EA, (AFUNPTR) LoadMulti,
+                        IARG_THREAD_ID,
+                        IARG_MEMORYREAD_EA,
+                        IARG_MEMORYREAD_SIZE,
+                        IARG_UINT32, instId,
+                        IARG_END);
+            }
+
+        }
+        else
+        {
+            if( single )
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYREAD_EA, (AFUNPTR) LoadSingleFast,
+                        IARG_MEMORYREAD_EA,
+                        IARG_UINT32, size,
+                        IARG_END);
+
+            }
+            else
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYREAD_EA, (AFUNPTR) LoadMultiFast,
+                        IARG_MEMORYREAD_EA,
+                        IARG_MEMORYREAD_SIZE,
+                        IARG_END);
+            }
+        }
+    }
+
+    if ( writes && INS_IsStandardMemop(ins))
+    {
+        // map sparse INS addresses to dense IDs
+        const ADDRINT iaddr = INS_Address(ins);
+        const UINT32 instId = profile.Map(iaddr);
+
+        const UINT32 size = INS_MemoryWriteSize(ins);
+
+        const BOOL   single = (size <= 4);
+
+        if( KnobTrackStores || codeProfile != NULL || deadBlocks != NULL || wayPartition != NULL )
+        {
+            if( single )
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYWRITE_EA, (AFUNPTR) StoreSingle,
+                        IARG_THREAD_ID,
+                        IARG_MEMORYWRITE_EA,
+                        IARG_UINT32, size,
+                        IARG_UINT32, instId,
+                        IARG_END);
+            }
+            else
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYWRITE_EA, (AFUNPTR) StoreMulti,
+                        IARG_THREAD_ID,
+                        IARG_MEMORYWRITE_EA,
+                        IARG_MEMORYWRITE_SIZE,
+                        IARG_UINT32, instId,
+                        IARG_END);
+            }
+
+        }
+        else
+        {
+            if( single )
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYWRITE_EA, (AFUNPTR) StoreSingleFast,
+                        IARG_MEMORYWRITE_EA,
+                        IARG_UINT32, size,
+                        IARG_END);
+
+            }
+            else
+            {
+                INSERT_MEMOP_CALL(
+                        ins, IARG_MEMORYWRITE_EA, (AFUNPTR) StoreMultiFast,
+                        IARG_MEMORYWRITE_EA,
+                        IARG_MEMORYWRITE_SIZE,
+                        IARG_END);
+            }
+        }
+
+    }
+
+    // gathers/scatters: one EA per vector element, read and write sides together
+    if ( (reads || writes) && !INS_IsStandardMemop(ins))
+    {
+        const BOOL track = (reads && KnobTrackLoads) ||
+                           (writes && KnobTrackStores) ||
+                           codeProfile != NULL || deadBlocks != NULL || wayPartition != NULL;
+
+        if( track )
+        {
+            // map sparse INS addresses to dense IDs
+            const ADDRINT iaddr = INS_Address(ins);
+            const UINT32 instId = profile.Map(iaddr);
+
+            INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) MultiMem,
+                    IARG_THREAD_ID,
+                    IARG_MULTI_MEMORYACCESS_EA,
+                    IARG_UINT32, instId,
+                    IARG_END);
+        }
+        else
+        {
+            INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE,  (AFUNPTR) MultiMemFast,
+                    IARG_MULTI_MEMORYACCESS_EA,
+                    IARG_END);
+        }
+    }
+}
+
+/* ===================================================================== */
+
+VOID Fini(int code, VOID * v)
+{
+    // print D-cache profile
+    // @todo what does this print
+
+    if (pipeline != NULL)
+        pipeline->Drain();
+    if (l2Shards != NULL)
+        l2Shards->Drain();
+    if (intervals != NULL)
+        intervals->Finish();
+    if (liveStats != NULL)
+        liveStats->Finish();
+    if (wcBuffer != NULL)
+        wcBuffer->Fence();
+
+    cout <<"trace is done\n";
+
+    outFile << "PIN:MEMLATENCIES 1.0. 0x0\n";
+
+    outFile <<
+            "#\n"
+            "# DCACHE stats\n"
+            "#\n";
+
+    outFile << dl1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    for (UINT32 core = 1; core < numCores; core++)
+    {
+        outFile << dl1s[core]->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    }
+
+    if (il1 != NULL) {
+        outFile <<
+                "#\n"
+                "# ICACHE stats\n"
+                "#\n";
+
+        outFile << il1->StatsLong("# ", CACHE_BASE::CACHE_TYPE_ICACHE);
+    }
+
+    outFile <<
+            "#\n"
+            "# L2 stats\n"
+            "#\n";
+
+    outFile << l2->StatsLong("# ", CACHE_BASE::CACHE_TYPE_DCACHE);
+    if (l2Shards != NULL)
+        outFile << l2Shards->StatsLong("# ");
+
+    if (compressedL2 != NULL) {
+        outFile <<
+                "#\n"
+                "# L2 COMPRESSION stats\n"
+                "#\n";
+
+        outFile << compressedL2->CompressionStatsLong("# ");
+    }
+
+    if (llcSlices != NULL) {
+        outFile <<
+                "#\n"
+                "# L2 SLICE stats\n"
+                "#\n";
+
+        outFile << llcSlices->SliceStatsLong("# ");
+    }
+
+    if (wayPartition != NULL) {
+        outFile <<
+                "#\n"
+                "# L2 PARTITION stats\n"
+                "#\n";
+
+        outFile << wayPartition->StatsLong("# ");
+    }
+
+    if (dtlb != NULL) {
+        outFile <<
+                "#\n"
+                "# DTLB stats\n"
+                "#\n";
+
+        for (UINT32 core = 0; core < numCores; core++)
+        {
+            if (numCores > 1)
+                outFile << "# core " << core << ":\n";
+            outFile << dtlbs[core]->StatsLong("# ");
+        }
+    }
+
+    if (wcBuffer != NULL) {
+        outFile <<
+                "#\n"
+                "# WRITE COMBINING stats\n"
+                "#\n";
+
+        outFile << wcBuffer->StatsLong("# ");
+    }
+
+    if (swPrefetch != NULL) {
+        outFile <<
+                "#\n"
+                "# PREFETCH stats\n"
+                "#\n";
+
+        outFile << swPrefetch->StatsLong("# ");
+    }
+
+    if (deadBlocks != NULL) {
+        outFile <<
+                "#\n"
+                "# DEAD BLOCK stats\n"
+                "#\n";
+
+        outFile << deadBlocks->StatsLong("# ", profile, KnobProfileTop.Value());
+    }
+
+    if (physicalMemory != NULL) {
+        outFile <<
+                "#\n"
+                "# PHYSICAL MEMORY stats\n"
+                "#\n";
+
+        outFile << physicalMemory->StatsLong("# ");
+    }
+
+    if (directory != NULL) {
+        outFile <<
+                "#\n"
+                "# COHERENCE stats\n"
+                "#\n";
+
+        outFile << directory->StatsLong("# ");
+    }
+
+    if (mainMemory != NULL) {
+        outFile <<
+                "#\n"
+                "# MEMORY tier stats\n"
+                "#\n";
+
+        outFile << mainMemory->StatsLong("# ");
+    }
+
+    if( KnobTrackLoads || KnobTrackStores || numCores > 1 || pipeline != NULL || codeProfile != NULL || deadBlocks != NULL ||
+        wayPartition != NULL ) {
+        outFile <<
+                "#\n"
+                "# LOAD stats\n"
+                "#\n";
+
+        outFile << profile.StringLong();
+    }
+
+    if (codeProfile != NULL) {
+        outFile <<
+                "#\n"
+                "# IMAGE and ROUTINE stats\n"
+                "#\n";
+
+        outFile << codeProfile->StatsLong("# ", profile, COUNTER_L2_MISS, KnobProfileTop.Value());
+
+        if (codeProfile->Contexts()) {
+            outFile <<
+                    "#\n"
+                    "# CALLING CONTEXT stats\n"
+                    "#\n";
+
+            outFile << codeProfile->ContextsLong("# ", profile, COUNTER_L2_MISS, KnobProfileTop.Value());
+        }
+    }
+
+    if (dataProfile != NULL) {
+        outFile <<
+                "#\n"
+                "# DATA OBJECT stats\n"
+                "#\n";
+
+        outFile << dataProfile->StatsLong("# ", KnobProfileTop.Value());
+    }
+
+    if (KnobFilterImage.NumberOfValues() != 0 || KnobFilterRoutine.NumberOfValues() != 0 ||
+        KnobNoStack || accessFilter.HasRanges()) {
+        outFile <<
+                "#\n"
+                "# FILTER stats\n"
+                "#\n";
+
+        outFile << accessFilter.StatsLong("# ");
+    }
+
+    if (selfProfiler.Enabled()) {
+        CACHE_STATS accesses = (il1 != NULL) ? il1->Accesses() : 0;
+        for (UINT32 core = 0; core < numCores; core++)
+            accesses += dl1s[core]->Accesses();
+
+        outFile <<
+                "#\n"
+                "# SELF PROFILE\n"
+                "#\n";
+
+        outFile << selfProfiler.StatsLong("# ", accesses);
+    }
+    outFile.close();
+    fprintf(my_file, "#eof\n");
+    fclose(my_file);
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+
+
+    //myfile.open();
+    PIN_InitSymbols();
+
+
+    my_file = fopen("my_trace.out", "w");
+
+
+    if( PIN_Init(argc,argv) )
+    {
+        return Usage();
+    }
+
+    outFile.open(KnobOutputFile.Value().c_str());
+
+    if (KnobBench.Value() != 0)
+    {
+        const UINT32 mismatches = RunBench(outFile, KnobBench.Value(), DL1::Create, DL1::CreateGeneric);
+        outFile.close();
+        return (mismatches != 0);
+    }
+
+    //dl1 = new DL1::CACHE("L1 Data Cache",
+    //                     KnobCacheSize.Value() * KILO,
+    //                     KnobLineSize.Value(),
+    //                     KnobAssociativity.Value());
+
+    dl1 = DL1::Create("L1 ",  32*KILO, 64, 4,1,4); //(KnobCacheSize.Value() * KILO,KnobLineSize.Value(),KnobAssociativity.Value());
+    if (KnobCompress)
+    {
+        // the compressed level has no forwarding and no exclusive hand-over
+        if (KnobL2Shards.Value() > 1 || KnobL2Inclusion.Value() == "exclusive")
+        {
+            cerr << "a compressed L2 can not be sharded or exclusive" << endl;
+            return Usage();
+        }
+        compressedL2 = new COMPRESSED_CACHE("L2 ", 1024 * KILO, 64, 8,4,150, DL1::Create);
+        l2 = compressedL2;
+    }
+    else if (KnobSlices.Value() > 1)
+    {
+        const UINT32 numSlices = KnobSlices.Value();
+        if (!IsPower2(numSlices) || numSlices > MAX_LLC_SLICES)
+        {
+            cerr << "L2 slices must be a power of two up to " << MAX_LLC_SLICES << endl;
+            return Usage();
+        }
+        if (KnobL2Shards.Value() > 1)
+        {
+            cerr << "a sliced L2 can not be sharded" << endl;
+            return Usage();
+        }
+
+        SLICE_HASH::FUNCTION hash;
+        if (KnobSliceHash.Value() == "mod")
+            hash = SLICE_HASH::MODULO;
+        else if (KnobSliceHash.Value() == "xor")
+            hash = SLICE_HASH::XOR;
+        else if (KnobSliceHash.Value() == "mix")
+            hash = SLICE_HASH::MIX;
+        else
+        {
+            cerr << "unknown slice hash " << KnobSliceHash.Value() << endl;
+            return Usage();
+        }
+
+        llcSlices = new CACHE_SLICES("L2 ", 1024 * KILO, 64, 8,4,150,
+                                     numSlices, hash, KnobHopLatency.Value(), DL1::Create);
+        l2 = llcSlices;
+    }
+    else
+        l2  = DL1::Create("L2 ", 1024 * KILO, 64, 8,4,150);
+
+    dl1->setNextLevel(l2);
+    l2->setNextLevel(NULL);
+    l2->addPrevLevel(dl1);
+
+    numCores = KnobCores.Value();
+    if (numCores == 0 || numCores > MAX_COHERENT_CORES)
+    {
+        cerr << "number of cores must be between 1 and " << MAX_COHERENT_CORES << endl;
+        return Usage();
+    }
+
+    dl1s[0] = dl1;
+    for (UINT32 core = 1; core < numCores; core++)
+    {
+        dl1s[core] = DL1::Create("L1 core " + decstr(core) + " ", 32*KILO, 64, 4,1,4);
+        dl1s[core]->setNextLevel(l2);
+        l2->addPrevLevel(dl1s[core]);
+    }
+
+    if (numCores > 1)
+    {
+        PIN_InitLock(&coreLock);
+        directory = new DIRECTORY<CACHE_LEVEL>(dl1s, numCores, l2);
+        for (UINT32 core = 0; core < numCores; core++)
+        {
+            dl1s[core]->setEvictListener(DIRECTORY<CACHE_LEVEL>::Evicted, directory, core);
+        }
+    }
+
+    if (KnobL2Inclusion.Value() == "inclusive")
+        l2->setInclusion(CACHE_INCLUSION::INCLUSIVE);
+    else if (KnobL2Inclusion.Value() == "exclusive")
+        l2->setInclusion(CACHE_INCLUSION::EXCLUSIVE);
+    else if (KnobL2Inclusion.Value() != "nine")
+    {
+        cerr << "unknown L2 inclusion policy " << KnobL2Inclusion.Value() << endl;
+        return Usage();
+    }
+
+    if (KnobICache)
+    {
+        // instruction fetch hits are hidden by the front end
+        il1 = DL1::Create("L1 Instruction ", KnobICacheSize.Value() * KILO, 64,
+                          KnobICacheAssociativity.Value(), 0, 4);
+        il1->setNextLevel(l2);
+        l2->addPrevLevel(il1);
+    }
+
+    if (KnobDtlb)
+    {
+        TLB_PAGE_SIZE pageSize = TLB_PAGE_4K;
+        if (KnobPageSize.Value() == 2 * KILO)
+            pageSize = TLB_PAGE_2M;
+        else if (KnobPageSize.Value() == MEGA)
+            pageSize = TLB_PAGE_1G;
+        else if (KnobPageSize.Value() != 4)
+        {
+            cerr << "unsupported page size " << KnobPageSize.Value() << "K" << endl;
+            return Usage();
+        }
+        // every TLB level needs a power of two number of full sets
+        if (!TLB_LEVEL::Valid(KnobDtlbEntries.Value(), KnobDtlbAssociativity.Value()))
+        {
+            cerr << "L1 DTLB entries must be a power of two multiple of an associativity of 1 to "
+                 << TLB_MAX_ASSOCIATIVITY << endl;
+            return Usage();
+        }
+        if (!TLB_LEVEL::Valid(KnobStlbEntries.Value(), KnobStlbAssociativity.Value()))
+        {
+            cerr << "STLB entries must be a power of two multiple of an associativity of 1 to "
+                 << TLB_MAX_ASSOCIATIVITY << endl;
+            return Usage();
+        }
+        if (KnobPdeCacheEntries.Value() != 0 &&
+            !TLB_LEVEL::Valid(KnobPdeCacheEntries.Value(), TLB_PDE_ASSOCIATIVITY))
+        {
+            cerr << "PDE cache entries must be a power of two multiple of " << TLB_PDE_ASSOCIATIVITY << endl;
+            return Usage();
+        }
+
+        for (UINT32 core = 0; core < numCores; core++)
+        {
+            dtlbs[core] = new TLB(pageSize,
+                                  KnobDtlbEntries.Value(), KnobDtlbAssociativity.Value(),
+                                  KnobStlbEntries.Value(), KnobStlbAssociativity.Value(),
+                                  KnobPdeCacheEntries.Value(), KnobStlbPenalty.Value());
+        }
+        dtlb = dtlbs[0];
+    }
+
+    if (!KnobPhysical.Value().empty())
+    {
+        PHYS_POLICY::POLICY policy;
+        if (KnobPhysical.Value() == "seq")
+            policy = PHYS_POLICY::SEQUENTIAL;
+        else if (KnobPhysical.Value() == "random")
+            policy = PHYS_POLICY::RANDOM;
+        else if (KnobPhysical.Value() == "color")
+            policy = PHYS_POLICY::COLORED;
+        else
+        {
+            cerr << "unknown page allocation policy " << KnobPhysical.Value() << endl;
+            return Usage();
+        }
+
+        PHYS_THP::POLICY thp;
+        if (KnobHugePages.Value() == "never")
+            thp = PHYS_THP::NEVER;
+        else if (KnobHugePages.Value() == "always")
+            thp = PHYS_THP::ALWAYS;
+        else if (KnobHugePages.Value() == "collapse")
+            thp = PHYS_THP::COLLAPSE;
+        else
+        {
+            cerr << "unknown huge page policy " << KnobHugePages.Value() << endl;
+            return Usage();
+        }
+
+        // the shard threads would walk the page tables behind the allocator's back
+        if (KnobL2Shards.Value() > 1)
+        {
+            cerr << "physical addresses are not supported with a sharded L2" << endl;
+            return Usage();
+        }
+
+        // pages of one color share their L2 set index bits above the page offset
+        const UINT32 colors = std::max<UINT32>(1, l2->CacheSize() / l2->Associativity() >> PHYS_PAGE_SHIFT);
+        physicalMemory = new PHYSICAL_MEMORY(UINT64(KnobPhysicalSize.Value()) * MEGA, policy, colors,
+                                             thp, KnobCollapseThreshold.Value());
+        physicalMemory->SetLevel(l2);
+        for (UINT32 core = 0; core < numCores; core++)
+            dl1s[core]->setTranslation(physicalMemory);
+        if (il1 != NULL)
+            il1->setTranslation(physicalMemory);
+    }
+
+    // with several cores NT stores and prefetches stay coherent stores and loads
+    if (numCores == 1)
+    {
+        if (KnobWcEntries.Value() > WC_MAX_ENTRIES)
+        {
+            cerr << "at most " << WC_MAX_ENTRIES << " write-combining buffers" << endl;
+            return Usage();
+        }
+        if (KnobWcEntries.Value() != 0)
+            wcBuffer = new WC_BUFFER(dl1, KnobWcEntries.Value());
+        swPrefetch = new SOFTWARE_PREFETCH(dl1, l2);
+    }
+
+    if (KnobFastMemory.Value() != 0)
+    {
+        mainMemory = new Memory(UINT64(KnobFastMemory.Value()) * MEGA / MEM_PAGE_SIZE,
+                                KnobSlowLatency.Value(),
+                                KnobMigrationLimit.Value());
+    }
+
+    profile.SetCounterName(COUNTER_MISS, "dcache:miss");
+    profile.SetCounterName(COUNTER_HIT, "dcache:hit");
+    profile.SetCounterName(COUNTER_INVALIDATION, "invalidations");
+    profile.SetCounterName(COUNTER_COHERENCE_MISS, "coherence:miss");
+    profile.SetCounterName(COUNTER_FALSE_SHARING, "false:sharing");
+    profile.SetCounterName(COUNTER_L2_MISS, "l2:miss");
+    profile.SetCounterName(COUNTER_L2_WRITEBACK, "l2:writeback");
+
+    profile.SetThreshold(COUNTER_HIT, KnobThresholdHit.Value());
+    profile.SetThreshold(COUNTER_MISS, KnobThresholdMiss.Value());
+    // coherence events are rare, a miss sized threshold would hide them
+    profile.SetThreshold(COUNTER_INVALIDATION, KnobThresholdCoherence.Value());
+    profile.SetThreshold(COUNTER_COHERENCE_MISS, KnobThresholdCoherence.Value());
+    profile.SetThreshold(COUNTER_FALSE_SHARING, KnobThresholdCoherence.Value());
+    profile.SetThreshold(COUNTER_L2_MISS, KnobThresholdMiss.Value());
+    profile.SetThreshold(COUNTER_L2_WRITEBACK, KnobThresholdMiss.Value());
+
+    profile.SetOrder(COUNTER_MISS, KnobProfileTop.Value());
+
+    if (KnobPipeline)
+    {
+        pipeline = new PIPELINE(SimulateRecord);
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+
+        if (!pipeline->Start())
+        {
+            cerr << "could not start the simulator thread" << endl;
+            return 1;
+        }
+    }
+
+    if (KnobL2Shards.Value() > 1)
+    {
+        const UINT32 numShards = KnobL2Shards.Value();
+        if (!IsPower2(numShards) || numShards > MAX_CACHE_SHARDS)
+        {
+            cerr << "L2 shards must be a power of two up to " << MAX_CACHE_SHARDS << endl;
+            return Usage();
+        }
+        // back invalidations and exclusive hand-overs need the outcome of an L2 access
+        if (l2->getInclusion() != CACHE_INCLUSION::NON_INCLUSIVE)
+        {
+            cerr << "a sharded L2 has to be non-inclusive" << endl;
+            return Usage();
+        }
+        // the shard queues take one producer, application threads would race on them
+        if (pipeline == NULL && numCores == 1)
+        {
+            cerr << "a sharded L2 needs -pipe or -cores above 1" << endl;
+            return Usage();
+        }
+
+        // the shards answer no access, no instruction can be charged with its L2 outcome
+        cerr << "note: l2:miss and l2:writeback are not counted per instruction with a sharded L2" << endl;
+
+        l2Shards = new CACHE_SHARDS<CACHE_LEVEL>(l2, numShards, DL1::Create);
+        l2->setForward(l2Shards);
+        PIN_AddPrepareForFiniFunction(ShardsPrepareForFini, 0);
+
+        if (!l2Shards->Start())
+        {
+            cerr << "could not start the L2 shard threads" << endl;
+            return 1;
+        }
+    }
+
+    if (KnobInterval.Value() != 0)
+    {
+        const string name = KnobIntervalFile.Value();
+        const bool json = name.size() >= 6 && name.compare(name.size() - 6, 6, ".jsonl") == 0;
+
+        const CACHE_BASE * clock = NULL;
+        if (KnobIntervalUnit.Value() == "acc")
+            clock = dl1;
+        else if (KnobIntervalUnit.Value() != "ins")
+        {
+            cerr << "unknown interval unit " << KnobIntervalUnit.Value() << endl;
+            return Usage();
+        }
+
+        FILE * file = fopen(name.c_str(), "w");
+        if (file == NULL)
+        {
+            cerr << "could not open " << name << endl;
+            return 1;
+        }
+
+        intervals = new INTERVAL_STATS(file, json, KnobInterval.Value(), clock);
+        intervals->AddLevel("l1d", dl1);
+        for (UINT32 core = 1; core < numCores; core++)
+            intervals->AddLevel("l1d_" + decstr(core), dl1s[core]);
+        if (il1 != NULL)
+            intervals->AddLevel("l1i", il1);
+        intervals->AddLevel("l2", l2);
+        if (l2Shards != NULL)
+            intervals->SetRefresh(CACHE_SHARDS<CACHE_LEVEL>::Collect, l2Shards);
+        intervals->Start();
+    }
+
+    if (!KnobLiveStats.Value().empty())
+    {
+        liveStats = LIVE_STATS::Create(KnobLiveStats.Value(), KnobLiveEpoch.Value());
+        if (liveStats == NULL)
+        {
+            cerr << "could not create the statistics page " << KnobLiveStats.Value() << endl;
+            return 1;
+        }
+        liveStats->AddLevel("l1d", dl1);
+        if (il1 != NULL)
+            liveStats->AddLevel("l1i", il1);
+        liveStats->AddLevel("l2", l2);
+        if (l2Shards != NULL)
+            liveStats->SetRefresh(CACHE_SHARDS<CACHE_LEVEL>::Collect, l2Shards);
+    }
+
+    if (KnobSelfProfile)
+        selfProfiler.Enable();
+
+    if (KnobCodeProfile)
+    {
+        // the simulator replays accesses long after the shadow stack moved on
+        if (KnobContextDepth.Value() != 0 && pipeline != NULL)
+        {
+            cerr << "calling contexts are not kept in the pipelined mode" << endl;
+            return Usage();
+        }
+
+        codeProfile = new CODE_PROFILE<COUNTER_NUM>(KnobContextDepth.Value());
+        if (codeProfile->Contexts())
+            RTN_AddInstrumentFunction(Routine, 0);
+    }
+
+    if (KnobDeadBlocks)
+    {
+        // fills are charged to the instruction the simulation thread works on
+        if (l2Shards != NULL)
+        {
+            cerr << "dead blocks are not followed in a sharded L2" << endl;
+            return Usage();
+        }
+        if (compressedL2 != NULL || llcSlices != NULL)
+        {
+            cerr << "dead blocks are not followed in a compressed or sliced L2" << endl;
+            return Usage();
+        }
+
+        deadBlocks = new DEAD_BLOCKS(l2->CacheSize() / l2->LineSize());
+        l2->setBlockObserver(deadBlocks);
+    }
+
+    if (KnobCatMask.NumberOfValues() + KnobCatThread.NumberOfValues() + KnobCatRoutine.NumberOfValues() != 0)
+    {
+        // the masks are applied where a CACHE picks its victims
+        if (l2Shards != NULL || compressedL2 != NULL || llcSlices != NULL ||
+            l2->getInclusion() == CACHE_INCLUSION::EXCLUSIVE)
+        {
+            cerr << "way partitions need an allocating L2 that is not sharded, compressed or sliced" << endl;
+            return Usage();
+        }
+
+        wayPartition = new CACHE_PARTITION(l2->CacheSize() / l2->LineSize(), l2->Associativity());
+        for (UINT32 i = 0; i < KnobCatMask.NumberOfValues(); i++)
+        {
+            if (!wayPartition->SetMask(KnobCatMask.Value(i)))
+            {
+                cerr << "bad way mask " << KnobCatMask.Value(i) << endl;
+                return Usage();
+            }
+        }
+        for (UINT32 i = 0; i < KnobCatThread.NumberOfValues(); i++)
+        {
+            if (!wayPartition->MapThread(KnobCatThread.Value(i)))
+            {
+                cerr << "bad thread class " << KnobCatThread.Value(i) << endl;
+                return Usage();
+            }
+        }
+        for (UINT32 i = 0; i < KnobCatRoutine.NumberOfValues(); i++)
+        {
+            if (!wayPartition->MapRoutine(KnobCatRoutine.Value(i)))
+            {
+                cerr << "bad routine class " << KnobCatRoutine.Value(i) << endl;
+                return Usage();
+            }
+        }
+
+        wayPartition->SetNext(deadBlocks);
+        l2->setBlockObserver(wayPartition);
+        l2->setWayAllocation(wayPartition);
+    }
+
+    if (KnobDataObjects)
+    {
+        dataProfile = new DATA_PROFILE();
+        l2->setMissListener(DataMiss, dataProfile);
+        if (l2Shards != NULL)
+            l2Shards->SetMissListener(DataMiss, dataProfile);
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+        IMG_AddUnloadFunction(ImageUnload, 0);
+    }
+
+    if (llcSlices != NULL)
+        llcSlices->Finish();
+
+    for (UINT32 i = 0; i < KnobFilterImage.NumberOfValues(); i++)
+        accessFilter.AddImage(KnobFilterImage.Value(i));
+    for (UINT32 i = 0; i < KnobFilterRoutine.NumberOfValues(); i++)
+        accessFilter.AddRoutine(KnobFilterRoutine.Value(i));
+    accessFilter.SetNoStack(KnobNoStack);
+    for (UINT32 i = 0; i < KnobFilterRange.NumberOfValues(); i++)
+    {
+        if (!accessFilter.AddRange(KnobFilterRange.Value(i)))
+        {
+            cerr << "bad address range " << KnobFilterRange.Value(i) << endl;
+            return Usage();
+        }
+    }
+    accessFilter.Finish();
 
     INS_AddInstrumentFunction(Instruction, 0);
+    if (il1 != NULL)
+        TRACE_AddInstrumentFunction(Trace, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     // Never returns
@@ -43,6 +43,8 @@ END_LEGAL */
 #include <sstream>
 #include <cassert>
 #include <math.h>
+#include <vector>
+#include <algorithm>
 
 
 
@@ -64,12 +66,18 @@ typedef enum
     ACCESS_TYPE_NUM
 }ACCESS_TYPE;
 
-unsigned long long int ins_count=0;
+unsigned long long int ins_count=0;         // trace clock, instructions plus simulated penalties
+unsigned long long int retired_count=0;     // instructions only
 
 unsigned long long int current_count = 0;
 unsigned long long int prev_count = 0;
+// while a non-blocking access runs, the memory traffic it causes is
+// stamped at its issue, not after the penalties it pays on the way
+bool trace_at_issue = false;
+unsigned long long int trace_issue = 0;
 unsigned long long int mem_count_before_warmup = 0;
 unsigned long long int mem_count_after_warmup = 0;
+unsigned long long int trace_bytes = 0;
 
 
 typedef UINT64 CACHE_STATS; // type of cache hit/miss counters
@@ -128,6 +136,479 @@ static inline INT32 CeilLog2(UINT32 n)
     return FloorLog2(n - 1) + 1;
 }
 
+typedef enum
+{
+    SELF_PROF_DOCOUNT,
+    SELF_PROF_LOAD,             // load analysis routines, cache hierarchy included
+    SELF_PROF_STORE,
+    SELF_PROF_MULTI_MEM,
+    SELF_PROF_FETCH,
+    SELF_PROF_TRANSLATE,        // DTLB lookups and page walks
+    SELF_PROF_SET_FIND,         // set lookups of all levels
+    SELF_PROF_SET_REPLACE,
+    SELF_PROF_MEMORY,           // Memory::Access
+    SELF_PROF_TRACE,            // memory trace output
+    SELF_PROF_NUM
+} SELF_PROF_REGION;
+
+#define SELF_PROF_MAX_THREADS 1024
+
+static inline UINT64 ReadTsc()
+{
+    UINT32 lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (UINT64(hi) << 32) | lo;
+}
+
+/*!
+ *  @brief Cycle and call counts of the tool's own hot paths
+ *
+ *  Regions nest (a load includes the set lookups it causes), so the cycles
+ *  of a region are inclusive. Every thread counts into its own slot, the
+ *  slots are summed up for the report.
+ */
+class SELF_PROFILER
+{
+private:
+    typedef struct
+    {
+        UINT64 cycles[SELF_PROF_NUM];
+        UINT64 calls[SELF_PROF_NUM];
+    } COUNTERS;
+
+    COUNTERS * _threads[SELF_PROF_MAX_THREADS];
+    bool _enabled;
+    UINT64 _startTsc;
+    double _startTime;
+
+    static double WallTime()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+public:
+    SELF_PROFILER() : _enabled(false), _startTsc(0), _startTime(0)
+    {
+        for (UINT32 i = 0; i < SELF_PROF_MAX_THREADS; i++)
+            _threads[i] = NULL;
+    }
+
+    bool Enabled() const { return _enabled; }
+
+    VOID Enable()
+    {
+        _enabled = true;
+        _startTsc = ReadTsc();
+        _startTime = WallTime();
+    }
+
+    VOID Add(SELF_PROF_REGION region, UINT64 cycles)
+    {
+        const THREADID tid = PIN_ThreadId();
+        if (tid >= SELF_PROF_MAX_THREADS)
+            return;
+
+        // only the owning thread ever allocates its slot
+        if (_threads[tid] == NULL)
+            _threads[tid] = new COUNTERS();
+
+        _threads[tid]->cycles[region] += cycles;
+        _threads[tid]->calls[region]++;
+    }
+
+    /// @param accesses memory accesses simulated during the run
+    string StatsLong(string prefix, CACHE_STATS accesses) const;
+};
+
+SELF_PROFILER selfProfiler;
+
+/*!
+ *  @brief Times the enclosing block into a region of the self profiler
+ */
+class SELF_PROF_SCOPE
+{
+private:
+    const SELF_PROF_REGION _region;
+    const UINT64 _start;
+
+public:
+    SELF_PROF_SCOPE(SELF_PROF_REGION region)
+            : _region(region),
+              _start(selfProfiler.Enabled() ? ReadTsc() : 0)
+    {
+    }
+
+    ~SELF_PROF_SCOPE()
+    {
+        if (_start != 0)
+            selfProfiler.Add(_region, ReadTsc() - _start);
+    }
+};
+
+/*!
+ *  @brief Stats output method
+ */
+string SELF_PROFILER::StatsLong(string prefix, CACHE_STATS accesses) const
+{
+    static const char * names[SELF_PROF_NUM] =
+    {
+        "docount", "Load", "Store", "Gather/Scatter", "Fetch", "Translate",
+        "Set-Find", "Set-Replace", "Memory", "Trace-Write"
+    };
+
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    const UINT64 totalCycles = ReadTsc() - _startTsc;
+    const double seconds = WallTime() - _startTime;
+
+    string out;
+
+    out += prefix + ljstr("Region", headerWidth) + ljstr("       Calls", numberWidth)
+           + ljstr("       MCycles", numberWidth + 2) + ljstr("   Total", 9) + "  Cycles/Call\n";
+
+    for (UINT32 r = 0; r < SELF_PROF_NUM; r++)
+    {
+        UINT64 cycles = 0;
+        UINT64 calls = 0;
+        for (UINT32 t = 0; t < SELF_PROF_MAX_THREADS; t++)
+        {
+            if (_threads[t] == NULL)
+                continue;
+            cycles += _threads[t]->cycles[r];
+            calls += _threads[t]->calls[r];
+        }
+
+        out += prefix + ljstr(string(names[r]) + ":", headerWidth)
+               + mydecstr(calls, numberWidth)
+               + "  " + mydecstr(cycles / 1000000, numberWidth)
+               + "  " + fltstr(100.0 * cycles / totalCycles, 2, 6) + "%"
+               + "  " + fltstr(calls ? double(cycles) / calls : 0.0, 1, 11) + "\n";
+    }
+
+    out += prefix + "\n";
+    out += prefix + ljstr("Total-MCycles:   ", headerWidth)
+           + mydecstr(totalCycles / 1000000, numberWidth) + "\n";
+    out += prefix + ljstr("Wall-Seconds:    ", headerWidth)
+           + fltstr(seconds, 2, numberWidth) + "\n";
+    out += prefix + ljstr("Accesses:        ", headerWidth)
+           + mydecstr(accesses, numberWidth) + "\n";
+    out += prefix + ljstr("Accesses/Second: ", headerWidth)
+           + fltstr(seconds > 0 ? accesses / seconds : 0.0, 0, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+
+#define NUM_MICRO_PAGE 4
+#define NUM_MEM_INDEX (32*KILO)
+#define MEM_PAGE_SIZE (4*KILO)
+
+typedef struct page
+{
+    ADDRINT ID;
+    unsigned long long lastAcess;
+    UINT32 counter[NUM_MICRO_PAGE];
+    UINT32 epochAccess;     // accesses in the current tiering epoch
+    bool fast;              // page currently resides in the fast tier
+    struct page *next;
+} page_t;
+
+/*!
+ *  @brief Main memory behind the last level cache.
+ *
+ *  Counts per-page and per-micro-page accesses. With a non-zero fast tier
+ *  capacity it also models a two-tier memory (e.g. HBM/DRAM in front of
+ *  CXL/NVM): pages are placed in the fast tier on first touch while there
+ *  is room, and at every epoch boundary the hottest pages of the epoch are
+ *  migrated into the fast tier, displacing colder ones.
+ */
+class Memory
+{
+private:
+    page_t *pages[NUM_MEM_INDEX];
+    int _shiftMicroPage;
+    int _shiftPage;
+    int _shiftIndex;
+    int total_num_page_accessed;
+    int num_page_accessed;
+    int total_num_access;
+    int num_access;
+
+    // tiering params
+    const UINT64 _fastCapacity;     // in pages, 0 disables tiering
+    const UINT32 _slowPenalty;      // extra cycles for a slow tier access
+    const UINT32 _migrationLimit;   // max pages promoted per epoch, 0 is unlimited
+    const UINT64 _epochLength;
+
+    // tiering state
+    UINT64 _fastUsed;
+    UINT64 _epoch;
+
+    // tiering stats
+    CACHE_STATS _tierAccess[ACCESS_TYPE_NUM][2]; // [accessType][fast]
+    CACHE_STATS _promotions;
+    CACHE_STATS _demotions;
+    CACHE_STATS _epochs;
+
+    page_t * Lookup(ADDRINT addr);
+    VOID Migrate();
+
+public:
+
+    Memory(UINT64 fastCapacity = 0, UINT32 slowPenalty = 0, UINT32 migrationLimit = 0, UINT64 epochLength = EPOCH);
+    ~Memory();
+    /// @return true if the access was served by the fast tier
+    bool Access(ADDRINT addr, ACCESS_TYPE accessType);
+    void PrintStat();
+    void resetCounter();
+    string StatsLong(string prefix = "") const;
+};
+
+Memory::Memory(UINT64 fastCapacity, UINT32 slowPenalty, UINT32 migrationLimit, UINT64 epochLength)
+        : _fastCapacity(fastCapacity),
+          _slowPenalty(slowPenalty),
+          _migrationLimit(migrationLimit),
+          _epochLength(epochLength)
+{
+    for(int i=0;i<NUM_MEM_INDEX;i++)
+    {
+        pages[i]=NULL;
+    }
+    _shiftPage  = FloorLog2(MEM_PAGE_SIZE);
+    _shiftIndex = FloorLog2(NUM_MEM_INDEX);
+    _shiftMicroPage = FloorLog2(NUM_MICRO_PAGE);
+    total_num_page_accessed=0;
+    num_page_accessed=0;
+    total_num_access=0;
+    num_access=0;
+
+    _fastUsed = 0;
+    _epoch = 0;
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+    {
+        _tierAccess[accessType][false] = 0;
+        _tierAccess[accessType][true] = 0;
+    }
+    _promotions = 0;
+    _demotions = 0;
+    _epochs = 0;
+}
+
+Memory::~Memory()
+{
+    for (int i = 0; i < NUM_MEM_INDEX; i++)
+    {
+        page_t *iter = pages[i];
+        while (iter != NULL)
+        {
+            page_t *next = iter->next;
+            delete iter;
+            iter = next;
+        }
+    }
+}
+
+/*!
+ *  @return the page holding addr, allocated on first touch
+ */
+page_t * Memory::Lookup(ADDRINT addr)
+{
+    const int index = (addr >> _shiftPage) & (NUM_MEM_INDEX-1);
+    const ADDRINT ID = addr >> (_shiftIndex+_shiftPage);
+
+    page_t *iter=pages[index];
+    page_t *lastPage=NULL;
+    while(iter!=NULL)
+    {
+        if(iter->ID==ID)
+        {
+            if((iter->lastAcess/_epochLength)!=(ins_count/_epochLength))
+            {
+                num_page_accessed++;
+            }
+            return iter;
+        }
+        lastPage=iter;
+        iter=iter->next;
+    }
+
+    page_t *newPage=new page_t();
+    if(lastPage)
+        lastPage->next=newPage;
+    else
+        pages[index]=newPage;
+    newPage->next=NULL;
+    newPage->ID=ID;
+    for(int i=0;i<NUM_MICRO_PAGE;i++)
+        newPage->counter[i]=0;
+    newPage->epochAccess=0;
+
+    // first touch placement
+    newPage->fast = (_fastUsed < _fastCapacity);
+    if (newPage->fast)
+        _fastUsed++;
+
+    num_page_accessed++;
+    total_num_page_accessed++;
+    return newPage;
+}
+
+bool Memory::Access(ADDRINT addr, ACCESS_TYPE accessType)
+{
+    SELF_PROF_SCOPE prof(SELF_PROF_MEMORY);
+
+    num_access++;
+    total_num_access++;
+
+    if (_fastCapacity != 0 && (ins_count / _epochLength) != _epoch)
+    {
+        Migrate();
+        _epoch = ins_count / _epochLength;
+    }
+
+    page_t *page = Lookup(addr);
+
+    const int counterIndex = (addr >> (_shiftPage - _shiftMicroPage)) & (NUM_MICRO_PAGE-1);
+    page->counter[counterIndex]++;
+    page->epochAccess++;
+    page->lastAcess=ins_count;
+
+    _tierAccess[accessType][page->fast]++;
+    if (!page->fast)
+        ins_count += _slowPenalty;
+
+    return page->fast;
+}
+
+static bool HotterPage(const page_t *a, const page_t *b)
+{
+    return a->epochAccess > b->epochAccess;
+}
+
+/*!
+ *  @brief Epoch boundary: promote the hottest slow pages of the epoch as long
+ *  as they are hotter than the coldest fast page, then restart the counts.
+ */
+VOID Memory::Migrate()
+{
+    std::vector<page_t *> hotSlow;
+    std::vector<page_t *> fast;
+
+    for (int i = 0; i < NUM_MEM_INDEX; i++)
+    {
+        for (page_t *iter = pages[i]; iter != NULL; iter = iter->next)
+        {
+            if (iter->fast)
+                fast.push_back(iter);
+            else if (iter->epochAccess != 0)
+                hotSlow.push_back(iter);
+        }
+    }
+
+    std::sort(hotSlow.begin(), hotSlow.end(), HotterPage);
+    std::sort(fast.begin(), fast.end(), HotterPage);
+
+    UINT64 migrated = 0;
+    for (size_t i = 0; i < hotSlow.size(); i++)
+    {
+        if (_migrationLimit != 0 && migrated == _migrationLimit)
+            break;
+
+        page_t *candidate = hotSlow[i];
+        if (_fastUsed == _fastCapacity)
+        {
+            // coldest fast page is at the back
+            page_t *victim = fast.empty() ? NULL : fast.back();
+            if (victim == NULL || victim->epochAccess >= candidate->epochAccess)
+                break;
+            fast.pop_back();
+            victim->fast = false;
+            _fastUsed--;
+            _demotions++;
+        }
+        candidate->fast = true;
+        _fastUsed++;
+        _promotions++;
+        migrated++;
+    }
+
+    for (int i = 0; i < NUM_MEM_INDEX; i++)
+    {
+        for (page_t *iter = pages[i]; iter != NULL; iter = iter->next)
+        {
+            iter->epochAccess = 0;
+        }
+    }
+    _epochs++;
+}
+
+void Memory::PrintStat()
+{
+    cerr << "total_num_page_accessed: " << total_num_page_accessed << endl;
+    cerr << "num_page_accessed: " << num_page_accessed << endl;
+    //cerr << "total_num_access: " << total_num_access << endl;
+    cerr << "num_access: " << num_access << endl;
+}
+
+void Memory::resetCounter()
+{
+    num_page_accessed=0;
+    num_access=0;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string Memory::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + "Memory:\n";
+
+    for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++)
+    {
+        const ACCESS_TYPE accessType = ACCESS_TYPE(i);
+
+        std::string type(accessType == ACCESS_TYPE_LOAD ? "Read" : "Write");
+        const CACHE_STATS total = _tierAccess[accessType][true] + _tierAccess[accessType][false];
+
+        out += prefix + ljstr(type + "-Fast:      ", headerWidth)
+               + mydecstr(_tierAccess[accessType][true], numberWidth) +
+               "  " +fltstr(100.0 * _tierAccess[accessType][true] / total, 2, 6) + "%\n";
+
+        out += prefix + ljstr(type + "-Slow:      ", headerWidth)
+               + mydecstr(_tierAccess[accessType][false], numberWidth) +
+               "  " +fltstr(100.0 * _tierAccess[accessType][false] / total, 2, 6) + "%\n";
+
+        out += prefix + "\n";
+    }
+
+    out += prefix + ljstr("Pages-Touched:   ", headerWidth)
+           + mydecstr(total_num_page_accessed, numberWidth) + "\n";
+    out += prefix + ljstr("Fast-Pages:      ", headerWidth)
+           + mydecstr(_fastUsed, numberWidth) + " / " + mydecstr(_fastCapacity, 0) + "\n";
+    out += prefix + ljstr("Epochs:          ", headerWidth)
+           + mydecstr(_epochs, numberWidth) + "\n";
+    out += prefix + ljstr("Promotions:      ", headerWidth)
+           + mydecstr(_promotions, numberWidth) + "\n";
+    out += prefix + ljstr("Demotions:       ", headerWidth)
+           + mydecstr(_demotions, numberWidth) + "\n";
+    out += prefix + ljstr("Migrated-Bytes:  ", headerWidth)
+           + mydecstr((_promotions + _demotions) * MEM_PAGE_SIZE, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+Memory *mainMemory = NULL;
+
 /*!
  *  @brief Cache tag - self clearing on creation
  */
@@ -140,7 +621,7 @@ private:
 
 
 public:
-    CACHE_TAG(ADDRINT tag = 0) { _tag = tag; dirty = false;}
+    CACHE_TAG(ADDRINT tag = 0) { _tag = tag; dirty = false; valid = false;}
     bool operator==(const CACHE_TAG &right) const { return _tag == right._tag; }
     operator ADDRINT() const { return _tag; }
     bool IsDirty(){return dirty;}
@@ -234,15 +715,26 @@ namespace CACHE_SET
         }
     };
 
-    template <UINT32 MAX_ASSOCIATIVITY=8>
+/*!
+ *  @brief Cache set with LRU replacement; with FIXED the set has exactly
+ *  MAX_ASSOCIATIVITY ways and every way loop has a constant trip count
+ */
+    template <UINT32 MAX_ASSOCIATIVITY=8, bool FIXED=false>
     class LRU
     {
     private:
         CACHE_TAG _tag[MAX_ASSOCIATIVITY];
         UINT32 _tagslastindex;
         int LRUNum[MAX_ASSOCIATIVITY];
+        UINT32 _lastWay;        // way of the last hit, fill or invalidation
+
+        UINT32 Ways() const { return FIXED ? MAX_ASSOCIATIVITY : _tagslastindex + 1; }
+        /// Fill masks cover the first 64 ways, the ones above are always allowed
+        static bool Allowed(UINT64 mask, int way) { return way >= 64 || ((mask >> way) & 1); }
     public:
         LRU(){
+            _tagslastindex = MAX_ASSOCIATIVITY - 1;
+            _lastWay = 0;
             for (int i=0; i<MAX_ASSOCIATIVITY; i++)
             {
                 LRUNum[i] = 0;
@@ -250,21 +742,19 @@ namespace CACHE_SET
             }
 
         }
-        ~LRU(){
-            cout << "LRU set is distructed....\n";
-        }
         void SetAssociativity(UINT32 associativity)
         {
-            ASSERTX(associativity <= MAX_ASSOCIATIVITY);
+            ASSERTX(FIXED ? associativity == MAX_ASSOCIATIVITY : associativity <= MAX_ASSOCIATIVITY);
             _tagslastindex = associativity-1;
         }
         UINT32 getAssociativity()
         {
-            return (_tagslastindex + 1);
+            return Ways();
         }
+        UINT32 LastWay() const { return _lastWay; }
         void update_LRU_array(int way)
         {
-            for (int i=0; i<=_tagslastindex; i++)
+            for (int i=0; i<Ways(); i++)
             {
                 if (i == way)
                     LRUNum[i] = 0;
@@ -278,7 +768,7 @@ namespace CACHE_SET
             ///int realIndex;
 
             // cout << dec << current_cycle() <<" : " << " FIND func " << " look for " << hex << tag << "\n" ;
-            for (int index=0; index<=_tagslastindex; index++)
+            for (int index=0; index<Ways(); index++)
             {
                 ///  realIndex = (int) ((LRUStack >> (4*index)) & 0x0f);
                 ///   cout << _tag[index].get_tag() << "  ";
@@ -291,6 +781,7 @@ namespace CACHE_SET
                     }
 
                     hit = true;
+                    _lastWay = index;
                     update_LRU_array(index);
                     //    cout << " >>>>  found \n";
                     //    cout << "----------------------------------------\n";
@@ -301,7 +792,7 @@ namespace CACHE_SET
             //cout << "----------------------------------------\n";
             return (hit);
         }
-        CACHE_TAG Replace(CACHE_TAG tag, ACCESS_TYPE access_type)
+        CACHE_TAG Replace(CACHE_TAG tag, ACCESS_TYPE access_type, UINT64 mask = ~UINT64(0))
         {
 
             int max_way = -2;
@@ -310,8 +801,10 @@ namespace CACHE_SET
             result.SetValid(false);
             result.SetDirty(false);
 
-            for (int i=0; i<=_tagslastindex; i++)
+            for (int i=0; i<Ways(); i++)
             {
+                if (!Allowed(mask, i))
+                    continue;
                 //   cout << "[ " <<i << " " << LRUnum[i] << " ]";
                 if (!_tag[i].IsValid())
                 {
@@ -326,9 +819,10 @@ namespace CACHE_SET
                 //LRUStack = LRUStack >> 2;
             }
             ///index = 5;
-            assert((index >= 0) && (index <= _tagslastindex));
+            assert((index >= 0) && (index < Ways()));
             //cout << "index = " << index <<"\n";
 
+            _lastWay = index;
             update_LRU_array(index);
 
             //cout << "my index = " << index <<" ";
@@ -336,7 +830,8 @@ namespace CACHE_SET
             //cout << " other index = " << index << "\n";
             //if (_tag[index].get_tag() == 0)
             //cout << current_cycle() <<": " << tag is zero not sure if it is
-            if (_tag[index].IsDirty() && _tag[index].IsValid()) {
+            // hand back every valid victim; callers write it back if dirty
+            if (_tag[index].IsValid()) {
                 // assert (_tag[index].IsValid());
                 result = _tag[index];
                 //   if (_tag[index].get_tag() == 0)
@@ -360,7 +855,7 @@ namespace CACHE_SET
         bool SetDirty(CACHE_TAG tag, bool value)
         {
             bool found = 0;
-            for (int i=0; i<=_tagslastindex; i++)
+            for (int i=0; i<Ways(); i++)
             {
                 if (_tag[i] == tag)
                 {
@@ -374,7 +869,7 @@ namespace CACHE_SET
 
         bool SetValid(CACHE_TAG tag, bool value) {
             bool found = 0;
-            for (int i = 0; i <= _tagslastindex; i++) {
+            for (int i = 0; i < Ways(); i++) {
                 if (_tag[i] == tag) {
                     found = 1;
                     _tag[i].SetValid(value);
@@ -383,6 +878,86 @@ namespace CACHE_SET
             return found;
         }
 
+        /// Single probe install: marks tag dirty if present, otherwise
+        /// puts it into the first invalid or the LRU way of mask
+        /// @return true if tag was already present
+        bool Fill(CACHE_TAG tag, bool dirty, CACHE_TAG & victim, UINT64 mask = ~UINT64(0))
+        {
+            int invalid = -1;
+            int max_way = -1;
+            int index = 0;
+
+            victim.SetValid(false);
+            victim.SetDirty(false);
+
+            for (int i=0; i<Ways(); i++)
+            {
+                if (!_tag[i].IsValid())
+                {
+                    if (invalid < 0 && Allowed(mask, i))
+                        invalid = i;
+                    continue;
+                }
+                if (_tag[i] == tag)
+                {
+                    if (dirty)
+                        _tag[i].SetDirty(true);
+                    _lastWay = i;
+                    update_LRU_array(i);
+                    return true;
+                }
+                if (Allowed(mask, i) && LRUNum[i] >= max_way)
+                {
+                    max_way = LRUNum[i];
+                    index = i;
+                }
+            }
+            if (invalid >= 0)
+                index = invalid;
+
+            _lastWay = index;
+            update_LRU_array(index);
+            if (_tag[index].IsValid())
+                victim = _tag[index];
+            _tag[index] = tag;
+            _tag[index].SetValid(true);
+            _tag[index].SetDirty(dirty);
+            return false;
+        }
+
+        /// @return true if tag was present and modified; it is clean afterwards
+        bool Clean(CACHE_TAG tag)
+        {
+            for (int i=0; i<Ways(); i++)
+            {
+                if ((_tag[i] == tag) && _tag[i].IsValid())
+                {
+                    const bool dirty = _tag[i].IsDirty();
+                    _tag[i].SetDirty(false);
+                    return dirty;
+                }
+            }
+            return false;
+        }
+
+        /// @return true if tag was present; dirty tells whether it was modified
+        bool Invalidate(CACHE_TAG tag, bool & dirty)
+        {
+            for (int i=0; i<Ways(); i++)
+            {
+                if ((_tag[i] == tag) && _tag[i].IsValid())
+                {
+                    dirty = _tag[i].IsDirty();
+                    _lastWay = i;
+                    _tag[i].SetValid(false);
+                    _tag[i].SetDirty(false);
+                    return true;
+                }
+            }
+            dirty = false;
+            return false;
+        }
+
 
     };
 
@@ -398,6 +973,17 @@ namespace CACHE_ALLOC
     } STORE_ALLOCATION;
 }
 
+namespace CACHE_INCLUSION
+{
+    // policy of a level with respect to the levels above it
+    typedef enum
+    {
+        NON_INCLUSIVE,  // NINE: lines may or may not be held above
+        INCLUSIVE,      // everything above is held here, evictions back-invalidate
+        EXCLUSIVE       // only holds lines evicted from above
+    } POLICY;
+}
+
 /*!
  *  @brief Generic cache base class; no allocate specialization, no cache set specialization
  */
@@ -422,6 +1008,9 @@ public:
 protected:
     static const UINT32 HIT_MISS_NUM = 2;
     CACHE_STATS _access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    CACHE_STATS _install[HIT_MISS_NUM];     // writebacks and victims pushed in from above
+    CACHE_STATS _writebacks;                // dirty lines evicted from this level
+    CACHE_STATS _backInvalidations;
 
 private:    // input params
     const std::string _name;
@@ -432,6 +1021,7 @@ private:    // input params
     // computed params
     const UINT32 _lineShift;
     const UINT32 _setIndexMask;
+    UINT32 _setShift;           // low tag bits skipped by the set index
 
     CACHE_STATS SumAccess(bool hit) const
     {
@@ -447,6 +1037,7 @@ private:    // input params
 
 protected:
     UINT32 NumSets() const { return _setIndexMask + 1; }
+    UINT32 SetShift() const { return _setShift; }
     std::string get_name() {return _name;}
 public:
     // constructors/destructors
@@ -463,11 +1054,14 @@ public:
     CACHE_STATS Hits() const { return SumAccess(true);}
     CACHE_STATS Misses() const { return SumAccess(false);}
     CACHE_STATS Accesses() const { return Hits() + Misses();}
+    CACHE_STATS Installs(bool hit) const { return _install[hit];}
+    CACHE_STATS Writebacks() const { return _writebacks;}
+    CACHE_STATS BackInvalidations() const { return _backInvalidations;}
 
     VOID SplitAddress(const ADDRINT addr, CACHE_TAG & tag, UINT32 & setIndex) const
     {
         tag = addr >> _lineShift;
-        setIndex = tag & _setIndexMask;
+        setIndex = (tag >> _setShift) & _setIndexMask;
     }
 
     ADDRINT RecoverAddress (ADDRINT tag)
@@ -482,6 +1076,18 @@ public:
         SplitAddress(addr, tag, setIndex);
     }
 
+    /// Index sets with tag bits above the low shift bits only; a slice
+    /// holding every 2^shift-th set of a larger cache uses this
+    VOID SetIndexShift(UINT32 shift) { _setShift = shift; }
+
+    /// Add the statistics of other to this level's
+    VOID MergeStats(const CACHE_BASE & other);
+    /// Zero every statistic
+    VOID ClearStats();
+    /// Overwrite the access and writeback counts, for a level whose sets
+    /// are simulated elsewhere
+    VOID SetStats(const CACHE_STATS access[ACCESS_TYPE_NUM][2], CACHE_STATS writebacks);
+
     string StatsLong(string prefix = "", CACHE_TYPE = CACHE_TYPE_DCACHE) const;
 
     string GetName() {return _name;}
@@ -493,7 +1099,8 @@ CACHE_BASE::CACHE_BASE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT
           _lineSize(lineSize),
           _associativity(associativity),
           _lineShift(FloorLog2(lineSize)),
-          _setIndexMask((cacheSize / (associativity * lineSize)) - 1)
+          _setIndexMask((cacheSize / (associativity * lineSize)) - 1),
+          _setShift(0)
 {
 
     ASSERTX(IsPower2(_lineSize));
@@ -504,6 +1111,46 @@ CACHE_BASE::CACHE_BASE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT
         _access[accessType][false] = 0;
         _access[accessType][true] = 0;
     }
+    _install[false] = 0;
+    _install[true] = 0;
+    _writebacks = 0;
+    _backInvalidations = 0;
+}
+
+VOID CACHE_BASE::MergeStats(const CACHE_BASE & other)
+{
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+    {
+        _access[accessType][false] += other._access[accessType][false];
+        _access[accessType][true] += other._access[accessType][true];
+    }
+    _install[false] += other._install[false];
+    _install[true] += other._install[true];
+    _writebacks += other._writebacks;
+    _backInvalidations += other._backInvalidations;
+}
+
+VOID CACHE_BASE::ClearStats()
+{
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+    {
+        _access[accessType][false] = 0;
+        _access[accessType][true] = 0;
+    }
+    _install[false] = 0;
+    _install[true] = 0;
+    _writebacks = 0;
+    _backInvalidations = 0;
+}
+
+VOID CACHE_BASE::SetStats(const CACHE_STATS access[ACCESS_TYPE_NUM][2], CACHE_STATS writebacks)
+{
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+    {
+        _access[accessType][false] = access[accessType][false];
+        _access[accessType][true] = access[accessType][true];
+    }
+    _writebacks = writebacks;
 }
 
 /*!
@@ -553,6 +1200,20 @@ string CACHE_BASE::StatsLong(string prefix, CACHE_TYPE cache_type) const
     out += prefix + ljstr("Total-Accesses:  ", headerWidth)
            + mydecstr(Accesses(), numberWidth) +
            "  " +fltstr(100.0 * Accesses() / Accesses(), 2, 6) + "%\n";
+
+    if (cache_type != CACHE_TYPE_ICACHE) {
+        out += prefix + "\n";
+        out += prefix + ljstr("Installs-Hit:    ", headerWidth)
+               + mydecstr(_install[true], numberWidth) + "\n";
+        out += prefix + ljstr("Installs-Miss:   ", headerWidth)
+               + mydecstr(_install[false], numberWidth) + "\n";
+        out += prefix + ljstr("Writebacks:      ", headerWidth)
+               + mydecstr(_writebacks, numberWidth) + "\n";
+    }
+    if (_backInvalidations != 0) {
+        out += prefix + ljstr("Back-Invals:     ", headerWidth)
+               + mydecstr(_backInvalidations, numberWidth) + "\n";
+    }
     out += "\n";
 
     return out;
@@ -560,124 +1221,293 @@ string CACHE_BASE::StatsLong(string prefix, CACHE_TYPE cache_type) const
 
 
 /*!
- *  @brief Templated cache class with specific cache set allocation policies
+ *  @brief Takes over the accesses of a level, see CACHE_SHARDS in shard.h
+ */
+class CACHE_FORWARD
+{
+public:
+    virtual ~CACHE_FORWARD() {}
+    virtual VOID Access(ADDRINT addr, ACCESS_TYPE accessType) = 0;
+    virtual VOID Install(ADDRINT addr, bool dirty) = 0;
+};
+
+/// Brings the counters of a level simulated elsewhere up to date before
+/// they are read, see CACHE_SHARDS::Collect()
+typedef VOID (*STATS_REFRESH)(VOID * v);
+
+/*!
+ *  @brief Maps the addresses a level hands down, see PHYSICAL_MEMORY in physmem.h
+ */
+class ADDRESS_TRANSLATION
+{
+public:
+    virtual ~ADDRESS_TRANSLATION() {}
+    /// Physical address of addr, its page is mapped on first touch
+    virtual ADDRINT Physical(ADDRINT addr) = 0;
+    /// Virtual address mapped to the physical addr
+    /// @return false if no page is mapped there
+    virtual bool Virtual(ADDRINT addr, ADDRINT & vaddr) const = 0;
+};
+
+/*!
+ *  @brief Follows the lines through the ways of a level, see DEAD_BLOCKS
+ *  in deadblock.h; block is set * associativity + way
+ */
+class BLOCK_OBSERVER
+{
+public:
+    virtual ~BLOCK_OBSERVER() {}
+    /// A demand access found the line in block
+    virtual VOID Hit(UINT32 block) = 0;
+    /// A line was put into block, by a demand miss or an install from above
+    virtual VOID Fill(UINT32 block, bool demand) = 0;
+    /// The line in block left; dirty if this level wrote it back
+    virtual VOID Evict(UINT32 block, bool dirty) = 0;
+};
+
+/*!
+ *  @brief Restricts the ways a fill may take, see CACHE_PARTITION in partition.h
+ */
+class WAY_ALLOCATION
+{
+public:
+    virtual ~WAY_ALLOCATION() {}
+    /// Ways the next fill may replace, bit i for way i
+    virtual UINT64 FillMask() const = 0;
+};
+
+/*!
+ *  @brief A level of the hierarchy as the other levels and the tool see it
  *
- *  All that remains to be done here is allocate and deallocate the right
- *  type of cache sets.
+ *  Levels are linked through this interface, so neighbouring levels may
+ *  have different geometries. Everything that does not depend on the set
+ *  type or geometry lives here; the lookup itself is left to CACHE.
  */
-template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION>
-class CACHE : public CACHE_BASE
+class CACHE_LEVEL : public CACHE_BASE
 {
-private:
-    SET _sets[MAX_SETS];
-    CACHE* next_level;
+public:
+    // told about every line leaving this level
+    typedef VOID (*EVICT_LISTENER)(VOID * v, UINT32 id, ADDRINT addr);
+    // told about every line that misses in this level
+    typedef VOID (*MISS_LISTENER)(VOID * v, ADDRINT addr, ACCESS_TYPE accessType);
+
+protected:
+    CACHE_LEVEL* next_level;
+    std::vector<CACHE_LEVEL*> prev_levels;
+    CACHE_INCLUSION::POLICY inclusion;
     int hit_penalty;
     int miss_penalty;
 
+    EVICT_LISTENER evict_listener;
+    VOID * evict_listener_arg;
+    UINT32 evict_listener_id;
+
+    MISS_LISTENER miss_listener;
+    VOID * miss_listener_arg;
+
+    // set when the level's sets are simulated elsewhere; accesses are
+    // handed over without timing feedback and count as hits up here
+    CACHE_FORWARD * forward;
+    // set when memory traffic is only counted, no trace and no tiers
+    CACHE_STATS * memory_counter;
+    // set on virtually indexed levels, everything below is physical
+    ADDRESS_TRANSLATION * translation;
+    // set when the lifetime of every line is followed
+    BLOCK_OBSERVER * block_observer;
+    // set when fills are confined to some of the ways
+    WAY_ALLOCATION * way_allocation;
+
+    UINT64 FillMask() const
+    {
+        return (way_allocation != NULL) ? way_allocation->FillMask() : ~UINT64(0);
+    }
+
+    /// Get a missing line from the next level or memory
+    VOID Fetch(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill);
+    /// Get rid of a line replaced in this level
+    VOID Evict(CACHE_TAG victim);
+    VOID MemoryRead(ADDRINT addr, ACCESS_TYPE accessType);
+    VOID MemoryWrite(ADDRINT addr);
+
 public:
     // constructors/destructors
-    CACHE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
+    CACHE_LEVEL(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
             : CACHE_BASE(name, cacheSize, lineSize, associativity)
     {
+        next_level = NULL;
+        inclusion = CACHE_INCLUSION::NON_INCLUSIVE;
+        evict_listener = NULL;
+        evict_listener_arg = NULL;
+        evict_listener_id = 0;
+        miss_listener = NULL;
+        miss_listener_arg = NULL;
+        forward = NULL;
+        memory_counter = NULL;
+        translation = NULL;
+        block_observer = NULL;
+        way_allocation = NULL;
         hit_penalty = hit;
         miss_penalty = miss;
-        ASSERTX(NumSets() <= MAX_SETS);
-
-        for (UINT32 i = 0; i < NumSets(); i++)
-        {
-            _sets[i].SetAssociativity(associativity);
-        }
     }
+    virtual ~CACHE_LEVEL() {}
 
-    void setNextLevel(CACHE* nextLevel){next_level=nextLevel;}
+    void setNextLevel(CACHE_LEVEL* nextLevel){next_level=nextLevel;}
+    void addPrevLevel(CACHE_LEVEL* prevLevel){prev_levels.push_back(prevLevel);}
+    void setInclusion(CACHE_INCLUSION::POLICY policy){inclusion=policy;}
+    CACHE_INCLUSION::POLICY getInclusion() const {return inclusion;}
+    void setEvictListener(EVICT_LISTENER listener, VOID * v, UINT32 id)
+    {
+        evict_listener = listener;
+        evict_listener_arg = v;
+        evict_listener_id = id;
+    }
+    void setMissListener(MISS_LISTENER listener, VOID * v)
+    {
+        miss_listener = listener;
+        miss_listener_arg = v;
+    }
+    void setForward(CACHE_FORWARD * f){forward=f;}
+    void setMemoryCounter(CACHE_STATS * counter){memory_counter=counter;}
+    void setTranslation(ADDRESS_TRANSLATION * t){translation=t;}
+    void setBlockObserver(BLOCK_OBSERVER * observer){block_observer=observer;}
+    void setWayAllocation(WAY_ALLOCATION * allocation){way_allocation=allocation;}
+
+    /// Address of the line at addr as the levels below see it
+    ADDRINT Below(ADDRINT addr)
+    {
+        return (translation != NULL) ? translation->Physical(addr) : addr;
+    }
+    /// Address in this level of the line at addr below
+    /// @return false if the line can not be held here
+    bool FromBelow(ADDRINT addr, ADDRINT & own) const
+    {
+        own = addr;
+        return translation == NULL || translation->Virtual(addr, own);
+    }
 
 
 
     // modifiers
     /// Cache access from addr to addr+size-1
-    bool Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType);
+    virtual bool Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType) = 0;
     /// Cache access at addr that does not span cache lines
-    bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType);
-    bool SetDirty(ADDRINT addr);
-
-
-
+    bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType)
+    {
+        bool dirtyFill;
+        return AccessSingleLine(addr, accessType, dirtyFill);
+    }
+    /// As above; dirtyFill tells a level above that the line left an
+    /// exclusive level in modified state
+    virtual bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill) = 0;
+    /// Single probe install of a line evicted from the level above
+    virtual VOID Install(ADDRINT addr, bool dirty) = 0;
+    /// Drop the line at addr from this level and everything above
+    /// @return true if the line was held; dirty tells whether it was modified
+    virtual bool Invalidate(ADDRINT addr, bool & dirty) = 0;
+    /// Write permission is given up but the line stays
+    /// @return true if the line was held and modified
+    virtual bool Clean(ADDRINT addr) = 0;
+
+    /// Drop the line at addr here and in every level below, for stores
+    /// that go around the caches
+    /// @return number of levels that held the line
+    UINT32 Purge(ADDRINT addr);
+    /// Invalidate() for a coherence request, not counted as a back invalidation
+    bool Snoop(ADDRINT addr, bool & dirty);
+    /// Write the whole line at addr to memory past this level and the ones below
+    VOID WriteMemory(ADDRINT addr);
 };
 
+/// Creates a level of a given geometry, see CreateCache()
+typedef CACHE_LEVEL * (*CACHE_FACTORY)(std::string name, UINT32 cacheSize, UINT32 lineSize,
+                                       UINT32 associativity, int hit, int miss);
+
 /*!
- *  @return true if all accessed cache lines hit
+ *  @brief Templated cache class with specific cache set allocation policies
+ *
+ *  All that remains to be done here is allocate and deallocate the right
+ *  type of cache sets. A nonzero LINE_SHIFT fixes the geometry at compile
+ *  time: lines of 1 << LINE_SHIFT bytes and exactly MAX_SETS sets, so the
+ *  address split folds into shifts and masks by constants. See
+ *  CreateCache() for the geometries that get such an instantiation.
  */
-
-template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION>
-bool CACHE<SET,MAX_SETS,STORE_ALLOCATION>::Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType)
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT = 0>
+class CACHE : public CACHE_LEVEL
 {
-    // this is an "Non-Inclusive cache". it means that when a block will be taken in to the
-    // higher level of cache, it will be kept in the current level as well. As a block is to be brought
-    // to a level of cache, it needs to evict a cache line; if clean, the evicted cache line will be
-    // nicely thrown a way; If it is dirty it needs to be written back in to the lower level of cache.
-    // In a non-inclusive cache, we do not need to invalidate a cache line in lower levels, as a cache
-    // line is evicted.
-
-    const ADDRINT highAddr = addr + size;
-    bool allHit = true;
+private:
+    SET _sets[MAX_SETS];
 
-    const ADDRINT lineSize = LineSize();
-    const ADDRINT notLineMask = ~(lineSize - 1);
-    do
+    VOID Split(const ADDRINT addr, CACHE_TAG & tag, UINT32 & setIndex) const
     {
-        CACHE_TAG tag;
-        UINT32 setIndex;
+        if (LINE_SHIFT == 0)
+        {
+            SplitAddress(addr, tag, setIndex);
+            return;
+        }
+        tag = addr >> LINE_SHIFT;
+        setIndex = (tag >> SetShift()) & (MAX_SETS - 1);
+    }
 
-        SplitAddress(addr, tag, setIndex);
+    /// Lookup and fill of one line, no access statistics
+    bool AccessLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill);
 
-        SET & set = _sets[setIndex];
+    /// Block index of the way the set touched last, for the block observer
+    UINT32 Block(UINT32 setIndex) const
+    {
+        return setIndex * Associativity() + _sets[setIndex].LastWay();
+    }
 
-        bool localHit = set.Find(tag, accessType);
-        allHit &= localHit;
-        if(localHit)
-        {
-            ins_count+= hit_penalty;
-        }
-        else
+public:
+    // constructors/destructors
+    CACHE(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
+            : CACHE_LEVEL(name, cacheSize, lineSize, associativity, hit, miss)
+    {
+        ASSERTX(NumSets() <= MAX_SETS);
+        ASSERTX(LINE_SHIFT == 0 || (lineSize == (1U << LINE_SHIFT) && NumSets() == MAX_SETS));
+
+        for (UINT32 i = 0; i < NumSets(); i++)
         {
-            ins_count+= miss_penalty;
+            _sets[i].SetAssociativity(associativity);
         }
+    }
 
-        // on miss, loads always allocate, stores optionally
-        if ( (! localHit) && (accessType == ACCESS_TYPE_LOAD || STORE_ALLOCATION == CACHE_ALLOC::STORE_ALLOCATE)) {
-            CACHE_TAG victim = set.Replace(tag, accessType);
-            ADDRINT victim_tag;
-            if (victim.IsValid()) //(victim != 0)
-            {
-                /*if (VERBOSE)
-                    cout << std::dec << current_cycle() << ": " << std::hex << victim.get_tag() << " evicted from " << get_name()  <<"\n";*/
-                victim_tag = victim.GetTag();
-                victim_tag = RecoverAddress(victim_tag); // ,setIndex) ;
-                // cout << "recovered address is " << victim_tag  <<"\n"; // " from setIndex " << hex << setIndex << endl;
-            }
+    using CACHE_LEVEL::AccessSingleLine;
 
-            if (next_level != NULL) {
-                if (victim.IsValid() && victim.IsDirty()) {
+    bool Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType);
+    bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill);
+    VOID Install(ADDRINT addr, bool dirty);
+    bool Invalidate(ADDRINT addr, bool & dirty);
+    bool Clean(ADDRINT addr);
+};
 
-                    next_level->SetDirty(victim);
+/*!
+ *  @return true if all accessed cache lines hit
+ */
 
-                    /*if (VERBOSE)
-                        cout << std::dec <<  current_cycle() << ": " << std::hex << " victim " << victim_tag << " is stored in " << next_level->get_name() <<"\n";*/
-                    ///next_level->SetDirty(victim); inclusive
-                    //whether or not it is fond, we need to write it back
-                    next_level->AccessSingleLine(victim_tag, ACCESS_TYPE_STORE);
-                    /////next_level->AccessSingleLine(victim,)
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+bool CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType)
+{
+    const ADDRINT highAddr = addr + size;
+    bool allHit = true;
 
-                }
-                next_level->AccessSingleLine(tag, accessType);
-            }
-            /*else{
-                // this level is an external Memory
-                // if victum is dirty there is a write otherwise Nothing!
-                // for tag we need to read this block from memory whether or not it is a read request.
+    const ADDRINT lineSize = (LINE_SHIFT != 0) ? (ADDRINT(1) << LINE_SHIFT) : LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
+
+    if (forward != NULL)
+    {
+        do
+        {
+            forward->Access(addr, accessType);
+            addr = (addr & notLineMask) + lineSize;
+        }
+        while (addr < highAddr);
+        return true;
+    }
 
-            }*/
-        } // if local hit
+    do
+    {
+        bool dirtyFill;
+        allHit &= AccessLine(addr, accessType, dirtyFill);
 
         addr = (addr & notLineMask) + lineSize; // start of next cache line
     } // while
@@ -691,114 +1521,385 @@ bool CACHE<SET,MAX_SETS,STORE_ALLOCATION>::Access(ADDRINT addr, UINT32 size, ACC
 /*!
  *  @return true if accessed cache line hits
  */
-template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION>
-bool CACHE<SET,MAX_SETS,STORE_ALLOCATION>::AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType)
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+bool CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill)
 {
+    if (forward != NULL)
+    {
+        forward->Access(addr, accessType);
+        dirtyFill = false;
+        return true;
+    }
+
+    const bool hit = AccessLine(addr, accessType, dirtyFill);
+
+    _access[accessType][hit]++;
+    return hit;
+}
+
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+bool CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::AccessLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill)
+{
+    // How a level relates to the levels above it is set by its inclusion policy:
+    //  - non-inclusive (NINE): a block brought into a higher level is kept here as well, but
+    //    evicting it here does not touch the higher levels. Dirty victims are written back
+    //    into the next level.
+    //  - inclusive: like NINE, but evicting a block here back-invalidates it above, so the
+    //    higher levels are always a subset of this one.
+    //  - exclusive: blocks only get here as victims of the level above. A hit hands the
+    //    block up and drops it here, a miss is forwarded down without allocating here.
     CACHE_TAG tag;
     UINT32 setIndex;
 
-    SplitAddress(addr, tag, setIndex);
+    Split(addr, tag, setIndex);
 
     SET & set = _sets[setIndex];
 
-    bool hit = set.Find(tag, accessType);
+    bool hit;
+    {
+        SELF_PROF_SCOPE prof(SELF_PROF_SET_FIND);
+        hit = set.Find(tag, accessType);
+    }
 
-    if(hit)
-        ins_count+= hit_penalty;
-    else
-        ins_count+= miss_penalty;
+    // levels without a penalty may run off the simulation thread,
+    // they must not touch the clock
+    const int penalty = hit ? hit_penalty : miss_penalty;
+    if (penalty != 0)
+        ins_count += penalty;
 
-    // on miss, loads always allocate, stores optionally
-    if ( (! hit) && (accessType == ACCESS_TYPE_LOAD || STORE_ALLOCATION == CACHE_ALLOC::STORE_ALLOCATE))
+    if (!hit && miss_listener != NULL)
+        miss_listener(miss_listener_arg, addr, accessType);
+
+    if (hit && block_observer != NULL)
+        block_observer->Hit(Block(setIndex));
+
+    dirtyFill = false;
+
+    if (inclusion == CACHE_INCLUSION::EXCLUSIVE)
     {
-        CACHE_TAG victim = set.Replace(tag, accessType);
-        ADDRINT victim_tag = 0;
-        if (victim.IsValid())
+        if (hit)
         {
-            victim_tag = victim.GetTag();
-            victim_tag = RecoverAddress(victim_tag);
+            set.Invalidate(tag, dirtyFill);
+            if (block_observer != NULL)
+                block_observer->Evict(Block(setIndex), false);
         }
-        if (next_level != NULL) {
-            if (victim.IsValid() && victim.IsDirty()) {
+        else
+            Fetch(addr, accessType, dirtyFill);
+        return hit;
+    }
 
-                next_level->SetDirty(victim);
-                //whether or not it is fond, we need to write it back
-                next_level->AccessSingleLine(victim_tag, ACCESS_TYPE_STORE);
-            }
-            next_level->AccessSingleLine(addr, accessType);
+    // on miss, loads always allocate, stores optionally
+    if ( (! hit) && (accessType == ACCESS_TYPE_LOAD || STORE_ALLOCATION == CACHE_ALLOC::STORE_ALLOCATE))
+    {
+        CACHE_TAG victim;
+        {
+            SELF_PROF_SCOPE prof(SELF_PROF_SET_REPLACE);
+            victim = set.Replace(tag, accessType, FillMask());
         }
-        else{
-            // this level is an external Memory
-            // if victum is dirty there is a write otherwise Nothing!
-            // for tag we need to read this block from memory whether or not it is a read request.
-
-
-            long long int diff;
-            // write back into memory
-            current_count = ins_count;
-            diff = current_count - prev_count;
-            prev_count = ins_count;
-            if (victim.IsValid() && victim.IsDirty())
-            {
-                victim_tag = victim.GetTag();
-                victim_tag = RecoverAddress(victim_tag);
-                if (ins_count > WARMUP) {
-                    ADDRINT  vic = victim_tag & 0xFFFFFFFFFFFFFFC0;
-                    //cerr.flush();
-                    //cerr <<" META "<< std::dec << diff << " W " << std::hex << vic << endl;
-                    //cerr.flush();
-                    fprintf(my_file," META %lld W %lx\n", diff, vic);
-                    mem_count_after_warmup++;
-                }
-                else
-                    mem_count_before_warmup++;
-            }
-            victim_tag = victim.GetTag();
-            victim_tag = RecoverAddress(victim_tag);
-
-            if (ins_count > WARMUP) {
-                //uint64_t  vic = victim_tag & 0xFFFFFFFFFFFFFFC0;
-                //cerr.flush();
-                //cerr <<" META "<< std::dec << diff << " R " << std::hex << addr << " 26432 " << endl;
-                //cerr.flush();
-                fprintf(my_file," META %lld R %lx\n", diff, addr);
-                mem_count_after_warmup++;
-            }
-            else
-                mem_count_before_warmup++;
+        if (block_observer != NULL)
+        {
+            const UINT32 block = Block(setIndex);
+            if (victim.IsValid())
+                block_observer->Evict(block, victim.IsDirty());
+            block_observer->Fill(block, true);
         }
+        if (victim.IsValid())
+            Evict(victim);
+
+        bool fillDirty;
+        Fetch(addr, accessType, fillDirty);
+        if (fillDirty)
+            set.SetDirty(tag, true);
     } // if local hit
-    _access[accessType][hit]++;
+
     return hit;
 }
 
-template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION>
-bool CACHE<SET,MAX_SETS,STORE_ALLOCATION>::SetDirty(ADDRINT addr)
+VOID CACHE_LEVEL::Fetch(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill)
 {
-    // if it gets dirty meaning it is found here this function
-    // returns 1, Otherwise false will be returned.
+    if (next_level != NULL)
+        next_level->AccessSingleLine(Below(addr), accessType, dirtyFill);
+    else
+    {
+        // this level is the last one before memory; for tag we need to read
+        // this block from memory whether or not it is a read request.
+        dirtyFill = false;
+        MemoryRead(Below(addr), accessType);
+    }
+}
+
+VOID CACHE_LEVEL::Evict(CACHE_TAG victim)
+{
+    const ADDRINT victim_tag = RecoverAddress(victim.GetTag());
+    bool dirty = victim.IsDirty();
+
+    if (evict_listener != NULL)
+        evict_listener(evict_listener_arg, evict_listener_id, victim_tag);
+
+    if (inclusion == CACHE_INCLUSION::INCLUSIVE)
+    {
+        // keep the levels above a subset of this one; a modified copy
+        // above makes the line we are throwing out dirty
+        for (size_t i = 0; i < prev_levels.size(); i++)
+        {
+            ADDRINT prevAddr;
+            bool prevDirty;
+            if (prev_levels[i]->FromBelow(victim_tag, prevAddr) &&
+                prev_levels[i]->Invalidate(prevAddr, prevDirty) && prevDirty)
+                dirty = true;
+        }
+    }
+
+    if (dirty)
+        _writebacks++;
+
+    if (next_level != NULL)
+    {
+        // an exclusive level below takes every victim, otherwise
+        // only dirty ones need to go down
+        if (next_level->getInclusion() == CACHE_INCLUSION::EXCLUSIVE || dirty)
+            next_level->Install(Below(victim_tag), dirty);
+    }
+    else if (dirty)
+    {
+        MemoryWrite(Below(victim_tag));
+    }
+}
+
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+VOID CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::Install(ADDRINT addr, bool dirty)
+{
+    if (forward != NULL)
+    {
+        forward->Install(addr, dirty);
+        return;
+    }
+
     CACHE_TAG tag;
     UINT32 setIndex;
-    ///cerr << "in CACHE::SetDirty\n";
-    SplitAddress(addr, tag, setIndex);
-    SET & set = _sets[setIndex];
-    // if (!set.Find(tag,ACCESS_TYPE_STORE))
-    //	cerr <<"!! "<< GetName() << addr<< endl;
-    ///cerr << GetName() << "addr: " << addr << " tag: " << tag << "{\n";
-    //assert(set.Find(tag,ACCESS_TYPE_LOAD));
-    if (set.Find(tag,ACCESS_TYPE_LOAD))
-    {
-        //it is found, make it dirty
-        set.SetDirty(tag, ACCESS_TYPE_LOAD);
-        return (true);
-    } else
-        return (false);
-    ///cerr << "}\n";
-};
+
+    Split(addr, tag, setIndex);
+
+    CACHE_TAG victim;
+    const bool hit = _sets[setIndex].Fill(tag, dirty, victim, FillMask());
+    _install[hit]++;
+
+    if (!hit && block_observer != NULL)
+    {
+        const UINT32 block = Block(setIndex);
+        if (victim.IsValid())
+            block_observer->Evict(block, victim.IsDirty());
+        block_observer->Fill(block, false);
+    }
+
+    if (victim.IsValid())
+        Evict(victim);
+}
+
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+bool CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::Invalidate(ADDRINT addr, bool & dirty)
+{
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    Split(addr, tag, setIndex);
+
+    const bool found = _sets[setIndex].Invalidate(tag, dirty);
+    if (found)
+    {
+        _backInvalidations++;
+        if (block_observer != NULL)
+            block_observer->Evict(Block(setIndex), false);
+        // the line leaves this level as if it was evicted
+        if (evict_listener != NULL)
+            evict_listener(evict_listener_arg, evict_listener_id, RecoverAddress(tag.GetTag()));
+    }
+
+    if (inclusion == CACHE_INCLUSION::INCLUSIVE)
+    {
+        for (size_t i = 0; i < prev_levels.size(); i++)
+        {
+            ADDRINT prevAddr;
+            bool prevDirty;
+            if (prev_levels[i]->FromBelow(addr, prevAddr) &&
+                prev_levels[i]->Invalidate(prevAddr, prevDirty) && prevDirty)
+                dirty = true;
+        }
+    }
+
+    return found;
+}
+
+template <class SET, UINT32 MAX_SETS, UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+bool CACHE<SET,MAX_SETS,STORE_ALLOCATION,LINE_SHIFT>::Clean(ADDRINT addr)
+{
+    CACHE_TAG tag;
+    UINT32 setIndex;
+
+    Split(addr, tag, setIndex);
+
+    return _sets[setIndex].Clean(tag);
+}
+
+UINT32 CACHE_LEVEL::Purge(ADDRINT addr)
+{
+    // a modified copy is merged into the line that goes around it
+    bool dirty;
+    const UINT32 held = Invalidate(addr, dirty);
+    _backInvalidations -= held;     // counted by Invalidate()
+
+    return held + ((next_level != NULL) ? next_level->Purge(Below(addr)) : 0);
+}
+
+bool CACHE_LEVEL::Snoop(ADDRINT addr, bool & dirty)
+{
+    // the directory counts its own invalidations
+    const bool held = Invalidate(addr, dirty);
+    _backInvalidations -= held;     // counted by Invalidate()
+
+    return held;
+}
+
+VOID CACHE_LEVEL::WriteMemory(ADDRINT addr)
+{
+    if (next_level != NULL)
+        next_level->WriteMemory(Below(addr));
+    else
+        MemoryWrite(Below(addr));
+}
+
+VOID CACHE_LEVEL::MemoryRead(ADDRINT addr, ACCESS_TYPE accessType)
+{
+    if (memory_counter != NULL)
+    {
+        (*memory_counter)++;
+        return;
+    }
+
+    long long int diff;
+    current_count = trace_at_issue ? trace_issue : ins_count;
+    diff = current_count - prev_count;
+    prev_count = current_count;
+
+    if (current_count > WARMUP) {
+        //cerr.flush();
+        //cerr <<" META "<< std::dec << diff << " R " << std::hex << addr << " 26432 " << endl;
+        //cerr.flush();
+        SELF_PROF_SCOPE prof(SELF_PROF_TRACE);
+        trace_bytes += fprintf(my_file," META %lld R %lx\n", diff, addr);
+        mem_count_after_warmup++;
+    }
+    else
+        mem_count_before_warmup++;
+    if (mainMemory != NULL)
+        mainMemory->Access(addr, accessType);
+}
+
+VOID CACHE_LEVEL::MemoryWrite(ADDRINT victim_tag)
+{
+    if (memory_counter != NULL)
+    {
+        (*memory_counter)++;
+        return;
+    }
+
+    // a write back shares its interval with the read that caused it,
+    // so prev_count is only advanced by reads
+    long long int diff;
+    current_count = trace_at_issue ? trace_issue : ins_count;
+    diff = current_count - prev_count;
+
+    if (current_count > WARMUP) {
+        ADDRINT  vic = victim_tag & 0xFFFFFFFFFFFFFFC0;
+        //cerr.flush();
+        //cerr <<" META "<< std::dec << diff << " W " << std::hex << vic << endl;
+        //cerr.flush();
+        SELF_PROF_SCOPE prof(SELF_PROF_TRACE);
+        trace_bytes += fprintf(my_file," META %lld W %lx\n", diff, vic);
+        mem_count_after_warmup++;
+    }
+    else
+        mem_count_before_warmup++;
+    if (mainMemory != NULL)
+        mainMemory->Access(victim_tag, ACCESS_TYPE_STORE);
+}
 
 // define shortcuts
 #define CACHE_DIRECT_MAPPED(MAX_SETS, ALLOCATION) CACHE<CACHE_SET::DIRECT_MAPPED, MAX_SETS, ALLOCATION>
 #define CACHE_ROUND_ROBIN(MAX_SETS, MAX_ASSOCIATIVITY, ALLOCATION) CACHE<CACHE_SET::ROUND_ROBIN<MAX_ASSOCIATIVITY>, MAX_SETS, ALLOCATION>
 #define CACHE_LRU(MAX_SETS, MAX_ASSOCIATIVITY, ALLOCATION) CACHE<CACHE_SET::LRU<MAX_ASSOCIATIVITY>, MAX_SETS, ALLOCATION>
+#define CACHE_LRU_FIXED(SETS, ASSOCIATIVITY, ALLOCATION, LINE_SHIFT) \
+    CACHE<CACHE_SET::LRU<ASSOCIATIVITY, true>, SETS, ALLOCATION, LINE_SHIFT>
+
+/*!
+ *  @brief Fixed geometry LRU cache for the number of sets, NULL if there
+ *  is no instantiation for it
+ */
+template <UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT, UINT32 ASSOCIATIVITY>
+CACHE_LEVEL * CreateFixedCache(std::string name, UINT32 cacheSize, UINT32 associativity, int hit, int miss)
+{
+    const UINT32 lineSize = 1 << LINE_SHIFT;
+
+#define CACHE_FIXED_SETS(SETS) \
+      case SETS: \
+        return new CACHE_LRU_FIXED(SETS, ASSOCIATIVITY, STORE_ALLOCATION, LINE_SHIFT)( \
+                name, cacheSize, lineSize, associativity, hit, miss)
+
+    switch (cacheSize / (lineSize * associativity))
+    {
+      CACHE_FIXED_SETS(64);
+      CACHE_FIXED_SETS(128);
+      CACHE_FIXED_SETS(256);
+      CACHE_FIXED_SETS(512);
+      CACHE_FIXED_SETS(1024);
+      CACHE_FIXED_SETS(2048);
+      CACHE_FIXED_SETS(4096);
+      default:
+        return NULL;
+    }
+
+#undef CACHE_FIXED_SETS
+}
+
+template <UINT32 STORE_ALLOCATION, UINT32 LINE_SHIFT>
+CACHE_LEVEL * CreateFixedCache(std::string name, UINT32 cacheSize, UINT32 associativity, int hit, int miss)
+{
+    switch (associativity)
+    {
+      case 4:
+        return CreateFixedCache<STORE_ALLOCATION, LINE_SHIFT, 4>(name, cacheSize, associativity, hit, miss);
+      case 8:
+        return CreateFixedCache<STORE_ALLOCATION, LINE_SHIFT, 8>(name, cacheSize, associativity, hit, miss);
+      case 12:
+        return CreateFixedCache<STORE_ALLOCATION, LINE_SHIFT, 12>(name, cacheSize, associativity, hit, miss);
+      case 16:
+        return CreateFixedCache<STORE_ALLOCATION, LINE_SHIFT, 16>(name, cacheSize, associativity, hit, miss);
+      default:
+        return NULL;
+    }
+}
+
+/*!
+ *  @brief Create a cache level for the runtime configuration
+ *
+ *  The usual geometries (64 and 128 byte lines, 4, 8, 12 or 16 ways and
+ *  64 to 4096 sets) get an instantiation where line size, associativity
+ *  and number of sets are constants. Anything else is simulated by GENERIC.
+ */
+template <class GENERIC, UINT32 STORE_ALLOCATION>
+CACHE_LEVEL * CreateCache(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity, int hit, int miss)
+{
+    CACHE_LEVEL * cache = NULL;
+
+    if (lineSize == 64)
+        cache = CreateFixedCache<STORE_ALLOCATION, 6>(name, cacheSize, associativity, hit, miss);
+    else if (lineSize == 128)
+        cache = CreateFixedCache<STORE_ALLOCATION, 7>(name, cacheSize, associativity, hit, miss);
+
+    if (cache == NULL)
+        cache = new GENERIC(name, cacheSize, lineSize, associativity, hit, miss);
+
+    return cache;
+}
 
 #endif // PIN_CACHE_H
@@ -0,0 +1,280 @@
+/*! @file
+ *  This file contains the dead block analysis of a cache level
+ */
+
+#ifndef PIN_DEADBLOCK_H
+#define PIN_DEADBLOCK_H
+
+#include "dcache.h"
+#include "pcprofile.h"
+
+#define DEAD_BLOCK_BUCKETS 40
+
+// fills that are not made by a profiled instruction
+typedef enum
+{
+    DEAD_BLOCK_FETCH,           // instruction fetches
+    DEAD_BLOCK_PREFETCH,        // software prefetches
+    DEAD_BLOCK_INSTALL,         // victims and write backs installed from above
+    DEAD_BLOCK_SOURCE_NUM
+} DEAD_BLOCK_SOURCE;
+
+static const char * const DEAD_BLOCK_SOURCE_NAME[DEAD_BLOCK_SOURCE_NUM] =
+{
+    "(instruction fetch)", "(software prefetch)", "(install from above)"
+};
+
+/*!
+ *  @brief Lifetime of every line of a level, summed up per filling instruction
+ *
+ *  Fill source, fill time, hit count and last touch of each way live in a
+ *  side array indexed like the level's blocks, the set metadata stays as
+ *  it is. When a line leaves, its live time (fill to last hit) and dead
+ *  time (last touch to eviction) go into histograms and to the
+ *  instruction that brought it in. A line evicted without a single hit
+ *  was dead on arrival; written back on top of that, its fill only cost
+ *  bandwidth. Time is the tool's clock, instructions plus penalties.
+ */
+class DEAD_BLOCKS : public BLOCK_OBSERVER
+{
+private:
+    typedef struct
+    {
+        UINT32 source;          // instruction ID, SOURCE_BASE + DEAD_BLOCK_SOURCE or EMPTY
+        UINT32 hits;
+        UINT64 fill;
+        UINT64 touch;
+    } BLOCK;
+
+    typedef struct
+    {
+        UINT64 fills;
+        UINT64 evictions;
+        UINT64 dead;
+        UINT64 liveTime;
+        UINT64 deadTime;
+        UINT64 writebacks;
+        UINT64 deadWritebacks;
+    } SOURCE;
+
+    static const UINT32 EMPTY = ~0U;
+    static const UINT32 SOURCE_BASE = EMPTY - DEAD_BLOCK_SOURCE_NUM;
+
+    BLOCK * _blocks;
+    const UINT32 _numBlocks;
+    UINT32 _source;                         // of the next demand fill
+
+    std::vector<SOURCE> _instructions;      // by instruction ID
+    SOURCE _special[DEAD_BLOCK_SOURCE_NUM];
+
+    UINT64 _liveTimes[DEAD_BLOCK_BUCKETS];
+    UINT64 _deadTimes[DEAD_BLOCK_BUCKETS];
+
+    SOURCE & Source(UINT32 source);
+    static UINT32 Bucket(UINT64 time);
+    static string SourceLong(const SOURCE & source);
+
+public:
+    DEAD_BLOCKS(UINT32 numBlocks);
+
+    /// Demand fills from now on are made by the instruction
+    VOID SetInstruction(UINT32 instId) { _source = instId; }
+    VOID SetSource(DEAD_BLOCK_SOURCE source) { _source = SOURCE_BASE + source; }
+
+    VOID Hit(UINT32 block);
+    VOID Fill(UINT32 block, bool demand);
+    VOID Evict(UINT32 block, bool dirty);
+
+    /// Report with the top instructions by dead fills, 0 for all
+    template <UINT32 NUM>
+    string StatsLong(string prefix, const PC_PROFILE<NUM> & profile, UINT32 top) const;
+};
+
+DEAD_BLOCKS::DEAD_BLOCKS(UINT32 numBlocks)
+        : _numBlocks(numBlocks),
+          _source(SOURCE_BASE + DEAD_BLOCK_INSTALL)
+{
+    _blocks = new BLOCK[numBlocks];
+    for (UINT32 i = 0; i < numBlocks; i++)
+        _blocks[i].source = EMPTY;
+
+    memset(_special, 0, sizeof(_special));
+    memset(_liveTimes, 0, sizeof(_liveTimes));
+    memset(_deadTimes, 0, sizeof(_deadTimes));
+}
+
+DEAD_BLOCKS::SOURCE & DEAD_BLOCKS::Source(UINT32 source)
+{
+    if (source >= SOURCE_BASE)
+        return _special[source - SOURCE_BASE];
+
+    if (source >= _instructions.size())
+        _instructions.resize(source + 1, SOURCE());
+    return _instructions[source];
+}
+
+/// Power of two bucket, 0 holds time 0
+UINT32 DEAD_BLOCKS::Bucket(UINT64 time)
+{
+    UINT32 bucket = 0;
+    while (time != 0 && bucket < DEAD_BLOCK_BUCKETS - 1)
+    {
+        time >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+VOID DEAD_BLOCKS::Hit(UINT32 block)
+{
+    BLOCK & b = _blocks[block];
+    b.hits++;
+    b.touch = ins_count;
+}
+
+VOID DEAD_BLOCKS::Fill(UINT32 block, bool demand)
+{
+    BLOCK & b = _blocks[block];
+    b.source = demand ? _source : SOURCE_BASE + DEAD_BLOCK_INSTALL;
+    b.hits = 0;
+    b.fill = ins_count;
+    b.touch = ins_count;
+
+    Source(b.source).fills++;
+}
+
+VOID DEAD_BLOCKS::Evict(UINT32 block, bool dirty)
+{
+    BLOCK & b = _blocks[block];
+    if (b.source == EMPTY)
+        return;
+
+    SOURCE & source = Source(b.source);
+    const UINT64 deadTime = ins_count - b.touch;
+
+    source.evictions++;
+    source.deadTime += deadTime;
+    _deadTimes[Bucket(deadTime)]++;
+
+    if (b.hits == 0)
+    {
+        source.dead++;
+    }
+    else
+    {
+        source.liveTime += b.touch - b.fill;
+        _liveTimes[Bucket(b.touch - b.fill)]++;
+    }
+
+    if (dirty)
+    {
+        source.writebacks++;
+        source.deadWritebacks += (b.hits == 0);
+    }
+
+    b.source = EMPTY;
+}
+
+/*!
+ *  @brief Columns of one fill source
+ */
+string DEAD_BLOCKS::SourceLong(const SOURCE & source)
+{
+    const UINT32 numberWidth = 12;
+    const UINT64 live = source.evictions - source.dead;
+
+    return mydecstr(source.fills, numberWidth)
+           + mydecstr(source.dead, numberWidth)
+           + "  " + fltstr(source.evictions ? 100.0 * source.dead / source.evictions : 0.0, 2, 6) + "%"
+           + mydecstr(live ? source.liveTime / live : 0, numberWidth)
+           + mydecstr(source.evictions ? source.deadTime / source.evictions : 0, numberWidth)
+           + mydecstr(source.writebacks, numberWidth)
+           + mydecstr(source.deadWritebacks, numberWidth);
+}
+
+/*!
+ *  @brief Stats output method
+ */
+template <UINT32 NUM>
+string DEAD_BLOCKS::StatsLong(string prefix, const PC_PROFILE<NUM> & profile, UINT32 top) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    SOURCE total;
+    memset(&total, 0, sizeof(total));
+
+    std::vector<std::pair<UINT64, UINT32> > order;
+    for (UINT32 i = 0; i < _instructions.size() + DEAD_BLOCK_SOURCE_NUM; i++)
+    {
+        const bool special = i >= _instructions.size();
+        const SOURCE & source = special ? _special[i - _instructions.size()] : _instructions[i];
+        if (source.fills == 0)
+            continue;
+
+        total.fills += source.fills;
+        total.evictions += source.evictions;
+        total.dead += source.dead;
+        total.writebacks += source.writebacks;
+        total.deadWritebacks += source.deadWritebacks;
+
+        if (!special)
+            order.push_back(std::make_pair(source.dead, i));
+    }
+    std::sort(order.begin(), order.end(), std::greater<std::pair<UINT64, UINT32> >());
+    if (top != 0 && order.size() > top)
+        order.resize(top);
+
+    UINT32 resident = 0;
+    for (UINT32 i = 0; i < _numBlocks; i++)
+        resident += (_blocks[i].source != EMPTY);
+
+    string out;
+
+    out += prefix + ljstr("Fills:           ", headerWidth)
+           + mydecstr(total.fills, numberWidth) + "\n";
+    out += prefix + ljstr("Evictions:       ", headerWidth)
+           + mydecstr(total.evictions, numberWidth) + "\n";
+    out += prefix + ljstr("Dead-On-Arrival: ", headerWidth)
+           + mydecstr(total.dead, numberWidth) +
+           "  " + fltstr(total.evictions ? 100.0 * total.dead / total.evictions : 0.0, 2, 6) + "%\n";
+    out += prefix + ljstr("Writebacks:      ", headerWidth)
+           + mydecstr(total.writebacks, numberWidth) + "\n";
+    out += prefix + ljstr("Dead-Writebacks: ", headerWidth)
+           + mydecstr(total.deadWritebacks, numberWidth) + "\n";
+    out += prefix + ljstr("Resident:        ", headerWidth)
+           + mydecstr(resident, numberWidth) + "\n";
+    out += prefix + "\n";
+
+    out += prefix + ljstr("time below", headerWidth) + "    live lines   dead time\n";
+    for (UINT32 b = 0; b < DEAD_BLOCK_BUCKETS; b++)
+    {
+        if (_liveTimes[b] == 0 && _deadTimes[b] == 0)
+            continue;
+        out += prefix + ljstr(decstr(UINT64(1) << b), headerWidth)
+               + mydecstr(_liveTimes[b], numberWidth + 2)
+               + mydecstr(_deadTimes[b], numberWidth) + "\n";
+    }
+    out += prefix + "\n";
+
+    out += prefix + ljstr("rank", 6) + ljstr("iaddr", 19)
+           + "       fills        dead   dead%    avg-live    avg-dead  writebacks     dead-wb  function  source\n";
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const UINT32 id = order[i].second;
+        out += prefix + ljstr(decstr(i + 1), 6) + ljstr("0x" + hexstr(profile.Address(id)), 19)
+               + SourceLong(_instructions[id]) + "  " + profile.Location(id) + "\n";
+    }
+    for (UINT32 s = 0; s < DEAD_BLOCK_SOURCE_NUM; s++)
+    {
+        if (_special[s].fills == 0)
+            continue;
+        out += prefix + ljstr("-", 6) + ljstr("-", 19)
+               + SourceLong(_special[s]) + "  " + DEAD_BLOCK_SOURCE_NAME[s] + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_DEADBLOCK_H
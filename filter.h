@@ -0,0 +1,206 @@
+/*! @file
+ *  This file contains the filters that restrict which accesses are
+ *  simulated
+ */
+
+#ifndef PIN_FILTER_H
+#define PIN_FILTER_H
+
+#include <stdlib.h>
+
+#include "dcache.h"
+
+/*!
+ *  @brief Decides which memory operands get analysis calls
+ *
+ *  Images, routines and stack pointer relative operands are filtered at
+ *  instrumentation time, a filtered operand is not instrumented at all.
+ *  Address ranges can only be checked at analysis time; they are merged
+ *  into a sorted table that is searched before the simulation call.
+ */
+class ACCESS_FILTER
+{
+private:
+    std::vector<string> _images;        // "main" is the main executable
+    std::vector<string> _routines;
+    bool _noStack;
+
+    std::vector<ADDRINT> _starts;       // sorted, not overlapping
+    std::vector<ADDRINT> _ends;
+
+    UINT64 _kept;
+    UINT64 _dropped;
+
+    bool Code(INS ins) const;
+
+public:
+    ACCESS_FILTER();
+
+    /// Only simulate code of images whose file name contains name
+    VOID AddImage(const string & name) { _images.push_back(name); }
+    /// Only simulate code of the routine
+    VOID AddRoutine(const string & name) { _routines.push_back(name); }
+    /// Leave out operands addressed relative to the stack or frame pointer
+    VOID SetNoStack(bool noStack) { _noStack = noStack; }
+
+    /// Only simulate accesses inside a range, given as start:end or
+    /// start+length in hex
+    /// @return false if range can not be parsed
+    bool AddRange(const string & range);
+
+    /// Sort and merge the ranges, once all are added
+    VOID Finish();
+
+    bool HasRanges() const { return !_starts.empty(); }
+
+    // instrumentation time
+    bool Read(INS ins);
+    bool Write(INS ins);
+
+    /// If call of the analysis time filter
+    static ADDRINT PIN_FAST_ANALYSIS_CALL InRanges(const ACCESS_FILTER * filter, ADDRINT addr);
+
+    string StatsLong(string prefix = "") const;
+};
+
+ACCESS_FILTER::ACCESS_FILTER()
+        : _noStack(false),
+          _kept(0),
+          _dropped(0)
+{
+}
+
+bool ACCESS_FILTER::AddRange(const string & range)
+{
+    const size_t split = range.find_first_of(":+");
+    if (split == string::npos)
+        return false;
+
+    char * end;
+    const ADDRINT start = strtoull(range.c_str(), &end, 16);
+    if (end != range.c_str() + split)
+        return false;
+
+    const char * second = range.c_str() + split + 1;
+    ADDRINT last = strtoull(second, &end, 16);
+    if (end == second || *end != 0)
+        return false;
+    if (range[split] == '+')
+        last += start;
+
+    if (last <= start)
+        return false;
+
+    _starts.push_back(start);
+    _ends.push_back(last);
+    return true;
+}
+
+VOID ACCESS_FILTER::Finish()
+{
+    std::vector<std::pair<ADDRINT, ADDRINT> > ranges;
+    for (size_t i = 0; i < _starts.size(); i++)
+        ranges.push_back(std::make_pair(_starts[i], _ends[i]));
+    std::sort(ranges.begin(), ranges.end());
+
+    _starts.clear();
+    _ends.clear();
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (!_ends.empty() && ranges[i].first <= _ends.back())
+        {
+            _ends.back() = std::max(_ends.back(), ranges[i].second);
+            continue;
+        }
+        _starts.push_back(ranges[i].first);
+        _ends.push_back(ranges[i].second);
+    }
+}
+
+bool ACCESS_FILTER::Code(INS ins) const
+{
+    if (!_images.empty())
+    {
+        IMG img = IMG_FindByAddress(INS_Address(ins));
+        if (!IMG_Valid(img))
+            return false;
+
+        const string & name = IMG_Name(img);
+        const string file = name.substr(name.find_last_of('/') + 1);
+
+        bool match = false;
+        for (size_t i = 0; i < _images.size() && !match; i++)
+        {
+            match = (_images[i] == "main") ? IMG_IsMainExecutable(img)
+                                           : file.find(_images[i]) != string::npos;
+        }
+        if (!match)
+            return false;
+    }
+
+    if (!_routines.empty())
+    {
+        RTN rtn = INS_Rtn(ins);
+        if (!RTN_Valid(rtn))
+            return false;
+        if (std::find(_routines.begin(), _routines.end(), RTN_Name(rtn)) == _routines.end())
+            return false;
+    }
+
+    return true;
+}
+
+bool ACCESS_FILTER::Read(INS ins)
+{
+    if (!INS_IsMemoryRead(ins))
+        return false;
+
+    const bool keep = Code(ins) && !(_noStack && INS_IsStackRead(ins));
+    keep ? _kept++ : _dropped++;
+    return keep;
+}
+
+bool ACCESS_FILTER::Write(INS ins)
+{
+    if (!INS_IsMemoryWrite(ins))
+        return false;
+
+    const bool keep = Code(ins) && !(_noStack && INS_IsStackWrite(ins));
+    keep ? _kept++ : _dropped++;
+    return keep;
+}
+
+ADDRINT PIN_FAST_ANALYSIS_CALL ACCESS_FILTER::InRanges(const ACCESS_FILTER * filter, ADDRINT addr)
+{
+    const std::vector<ADDRINT> & starts = filter->_starts;
+
+    // the last range starting at or below addr
+    const size_t i = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin();
+    return i != 0 && addr < filter->_ends[i - 1];
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string ACCESS_FILTER::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + ljstr("Memops-Kept:     ", headerWidth)
+           + mydecstr(_kept, numberWidth) + "\n";
+    out += prefix + ljstr("Memops-Filtered: ", headerWidth)
+           + mydecstr(_dropped, numberWidth) + "\n";
+    for (size_t i = 0; i < _starts.size(); i++)
+    {
+        out += prefix + ljstr("Range:", headerWidth)
+               + "0x" + hexstr(_starts[i]) + "-0x" + hexstr(_ends[i]) + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_FILTER_H
@@ -0,0 +1,202 @@
+/*! @file
+ *  This file contains the interval statistics time series
+ */
+
+#ifndef PIN_INTERVAL_H
+#define PIN_INTERVAL_H
+
+#include <stdio.h>
+#include <atomic>
+
+#include "dcache.h"
+
+/*!
+ *  @brief Periodic snapshots of the cache levels
+ *
+ *  Every interval (a number of retired instructions, not the penalty
+ *  clock, or of accesses to a clock level) one row with the deltas since the previous row is appended to
+ *  a CSV or JSON lines file. Only the previous snapshot of every counter
+ *  is kept, nothing is recomputed. Any application thread may cross the
+ *  boundary, the one that moves it on writes the row under a lock.
+ */
+class INTERVAL_STATS
+{
+private:
+    typedef enum
+    {
+        LEVEL_LOAD_HITS,
+        LEVEL_LOAD_MISSES,
+        LEVEL_STORE_HITS,
+        LEVEL_STORE_MISSES,
+        LEVEL_WRITEBACKS,
+        LEVEL_NUM
+    } LEVEL_COUNTER;
+
+    typedef struct
+    {
+        std::string name;
+        const CACHE_BASE * cache;
+        CACHE_STATS last[LEVEL_NUM];
+    } LEVEL;
+
+    std::vector<LEVEL> _levels;
+    FILE * _file;
+    const bool _json;
+    const UINT64 _length;
+    const CACHE_BASE * _clock;      // NULL if intervals count instructions
+    std::atomic<UINT64> _next;
+    UINT64 _index;
+
+    UINT64 _lastIns;
+    UINT64 _lastMem;
+    UINT64 _lastTraceBytes;
+
+    STATS_REFRESH _refresh;
+    VOID * _refreshArg;
+    PIN_LOCK _lock;
+
+    UINT64 Now() const { return (_clock != NULL) ? _clock->Accesses() : retired_count; }
+
+    VOID Emit();
+
+public:
+    INTERVAL_STATS(FILE * file, bool json, UINT64 length, const CACHE_BASE * clock);
+
+    /// Add a level to every row, name is the column prefix
+    VOID AddLevel(std::string name, const CACHE_BASE * cache);
+
+    /// Call refresh before every row reads the levels
+    VOID SetRefresh(STATS_REFRESH refresh, VOID * v) { _refresh = refresh; _refreshArg = v; }
+
+    /// Write the CSV header once all levels are added
+    VOID Start();
+
+    /// Called once per instruction
+    inline VOID Check()
+    {
+        const UINT64 now = Now();
+        UINT64 next = _next.load(std::memory_order_relaxed);
+        if (now < next)
+            return;
+
+        // other threads may have moved the clock on, skip crossed boundaries
+        if (_next.compare_exchange_strong(next, (now / _length + 1) * _length))
+            Emit();
+    }
+
+    /// Emit the last, partial interval and close the file
+    VOID Finish();
+};
+
+INTERVAL_STATS::INTERVAL_STATS(FILE * file, bool json, UINT64 length, const CACHE_BASE * clock)
+        : _file(file),
+          _json(json),
+          _length(length),
+          _clock(clock),
+          _next(length),
+          _index(0),
+          _lastIns(0),
+          _lastMem(0),
+          _lastTraceBytes(0),
+          _refresh(NULL),
+          _refreshArg(NULL)
+{
+    PIN_InitLock(&_lock);
+}
+
+VOID INTERVAL_STATS::AddLevel(std::string name, const CACHE_BASE * cache)
+{
+    LEVEL level;
+    level.name = name;
+    level.cache = cache;
+    for (UINT32 i = 0; i < LEVEL_NUM; i++)
+        level.last[i] = 0;
+    _levels.push_back(level);
+}
+
+VOID INTERVAL_STATS::Start()
+{
+    if (_json)
+        return;
+
+    fprintf(_file, "interval,ins,delta_ins,mem_accesses,trace_bytes");
+    for (size_t i = 0; i < _levels.size(); i++)
+    {
+        const char * name = _levels[i].name.c_str();
+        fprintf(_file, ",%s_load_hits,%s_load_misses,%s_store_hits,%s_store_misses,%s_writebacks,%s_mpki",
+                name, name, name, name, name, name);
+    }
+    fprintf(_file, "\n");
+}
+
+VOID INTERVAL_STATS::Emit()
+{
+    PIN_GetLock(&_lock, 1);
+
+    const UINT64 mem = mem_count_before_warmup + mem_count_after_warmup;
+    const UINT64 deltaIns = retired_count - _lastIns;
+
+    if (_refresh != NULL)
+        _refresh(_refreshArg);
+
+    if (_json)
+        fprintf(_file, "{\"interval\":%llu,\"ins\":%llu,\"delta_ins\":%llu,\"mem_accesses\":%llu,\"trace_bytes\":%llu,\"levels\":{",
+                (unsigned long long) _index, (unsigned long long) retired_count, (unsigned long long) deltaIns,
+                (unsigned long long) (mem - _lastMem), (unsigned long long) (trace_bytes - _lastTraceBytes));
+    else
+        fprintf(_file, "%llu,%llu,%llu,%llu,%llu",
+                (unsigned long long) _index, (unsigned long long) retired_count, (unsigned long long) deltaIns,
+                (unsigned long long) (mem - _lastMem), (unsigned long long) (trace_bytes - _lastTraceBytes));
+
+    for (size_t i = 0; i < _levels.size(); i++)
+    {
+        LEVEL & level = _levels[i];
+
+        CACHE_STATS now[LEVEL_NUM];
+        now[LEVEL_LOAD_HITS] = level.cache->Hits(ACCESS_TYPE_LOAD);
+        now[LEVEL_LOAD_MISSES] = level.cache->Misses(ACCESS_TYPE_LOAD);
+        now[LEVEL_STORE_HITS] = level.cache->Hits(ACCESS_TYPE_STORE);
+        now[LEVEL_STORE_MISSES] = level.cache->Misses(ACCESS_TYPE_STORE);
+        now[LEVEL_WRITEBACKS] = level.cache->Writebacks();
+
+        CACHE_STATS delta[LEVEL_NUM];
+        for (UINT32 c = 0; c < LEVEL_NUM; c++)
+        {
+            delta[c] = now[c] - level.last[c];
+            level.last[c] = now[c];
+        }
+
+        const CACHE_STATS misses = delta[LEVEL_LOAD_MISSES] + delta[LEVEL_STORE_MISSES];
+        const double mpki = (deltaIns != 0) ? 1000.0 * misses / deltaIns : 0.0;
+
+        if (_json)
+            fprintf(_file, "%s\"%s\":{\"load_hits\":%llu,\"load_misses\":%llu,\"store_hits\":%llu,"
+                    "\"store_misses\":%llu,\"writebacks\":%llu,\"mpki\":%.3f}",
+                    (i == 0) ? "" : ",", level.name.c_str(),
+                    (unsigned long long) delta[LEVEL_LOAD_HITS], (unsigned long long) delta[LEVEL_LOAD_MISSES],
+                    (unsigned long long) delta[LEVEL_STORE_HITS], (unsigned long long) delta[LEVEL_STORE_MISSES],
+                    (unsigned long long) delta[LEVEL_WRITEBACKS], mpki);
+        else
+            fprintf(_file, ",%llu,%llu,%llu,%llu,%llu,%.3f",
+                    (unsigned long long) delta[LEVEL_LOAD_HITS], (unsigned long long) delta[LEVEL_LOAD_MISSES],
+                    (unsigned long long) delta[LEVEL_STORE_HITS], (unsigned long long) delta[LEVEL_STORE_MISSES],
+                    (unsigned long long) delta[LEVEL_WRITEBACKS], mpki);
+    }
+    fprintf(_file, _json ? "}}\n" : "\n");
+
+    _index++;
+    _lastIns = retired_count;
+    _lastMem = mem;
+    _lastTraceBytes = trace_bytes;
+
+    PIN_ReleaseLock(&_lock);
+}
+
+VOID INTERVAL_STATS::Finish()
+{
+    if (retired_count != _lastIns)
+        Emit();
+    fclose(_file);
+}
+
+#endif // PIN_INTERVAL_H
@@ -0,0 +1,138 @@
+/*! @file
+ *  This file contains the writer of the live statistics page
+ */
+
+#ifndef PIN_LIVESTATS_H
+#define PIN_LIVESTATS_H
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "dcache.h"
+#include "statspage.h"
+
+/*!
+ *  @brief Mirrors the progress counters into a file mapped shared, usually
+ *  under /dev/shm, so that statsview or a job scheduler can watch a run
+ *  without touching its output files. The file is left behind with the
+ *  done flag set when the tool finishes.
+ */
+class LIVE_STATS
+{
+private:
+    STATS_PAGE * _page;
+    const CACHE_BASE * _levels[STATS_PAGE_MAX_LEVELS];
+    const UINT64 _epoch;
+    std::atomic<UINT64> _next;
+
+    STATS_REFRESH _refresh;
+    VOID * _refreshArg;
+
+    VOID Update();
+
+public:
+    LIVE_STATS(STATS_PAGE * page, UINT64 epoch);
+
+    /// Map a fresh page at path
+    /// @return NULL if the page could not be created
+    static LIVE_STATS * Create(std::string path, UINT64 epoch);
+
+    VOID AddLevel(std::string name, const CACHE_BASE * cache);
+
+    /// Call refresh before every update reads the levels
+    VOID SetRefresh(STATS_REFRESH refresh, VOID * v) { _refresh = refresh; _refreshArg = v; }
+
+    /// Called once per instruction, by any application thread; the one
+    /// that moves the epoch on updates the page
+    inline VOID Check()
+    {
+        const UINT64 now = retired_count;
+        UINT64 next = _next.load(std::memory_order_relaxed);
+        if (now < next)
+            return;
+
+        if (_next.compare_exchange_strong(next, (now / _epoch + 1) * _epoch))
+            Update();
+    }
+
+    /// Publish the final counters and set the done flag
+    VOID Finish();
+};
+
+LIVE_STATS::LIVE_STATS(STATS_PAGE * page, UINT64 epoch)
+        : _page(page),
+          _epoch(epoch),
+          _next(epoch),
+          _refresh(NULL),
+          _refreshArg(NULL)
+{
+    _page->magic = STATS_PAGE_MAGIC;
+    _page->version = STATS_PAGE_VERSION;
+    _page->pid = getpid();
+    _page->numLevels = 0;
+}
+
+LIVE_STATS * LIVE_STATS::Create(std::string path, UINT64 epoch)
+{
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, sizeof(STATS_PAGE)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    VOID * page = mmap(NULL, sizeof(STATS_PAGE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+        return NULL;
+
+    // the file is zero filled, which is a valid state for every counter
+    return new LIVE_STATS(static_cast<STATS_PAGE *>(page), epoch);
+}
+
+VOID LIVE_STATS::AddLevel(std::string name, const CACHE_BASE * cache)
+{
+    ASSERTX(_page->numLevels < STATS_PAGE_MAX_LEVELS);
+
+    STATS_PAGE_LEVEL & level = _page->levels[_page->numLevels];
+    strncpy(level.name, name.c_str(), STATS_PAGE_NAME_SIZE - 1);
+    _levels[_page->numLevels++] = cache;
+}
+
+VOID LIVE_STATS::Update()
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    if (_refresh != NULL)
+        _refresh(_refreshArg);
+
+    for (UINT32 i = 0; i < _page->numLevels; i++)
+    {
+        _page->levels[i].hits.store(_levels[i]->Hits(), relaxed);
+        _page->levels[i].misses.store(_levels[i]->Misses(), relaxed);
+        _page->levels[i].writebacks.store(_levels[i]->Writebacks(), relaxed);
+    }
+    _page->insCount.store(retired_count, relaxed);
+    _page->clock.store(ins_count, relaxed);
+    _page->memBeforeWarmup.store(mem_count_before_warmup, relaxed);
+    _page->memAfterWarmup.store(mem_count_after_warmup, relaxed);
+    _page->traceBytes.store(trace_bytes, relaxed);
+    _page->timestamp.store(time(NULL), relaxed);
+    _page->updates.fetch_add(1, relaxed);
+}
+
+VOID LIVE_STATS::Finish()
+{
+    Update();
+    _page->done.store(1, std::memory_order_release);
+    munmap(_page, sizeof(STATS_PAGE));
+}
+
+#endif // PIN_LIVESTATS_H
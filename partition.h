@@ -0,0 +1,248 @@
+/*! @file
+ *  This file contains way partitioning and occupancy monitoring of a
+ *  cache level by class of service
+ */
+
+#ifndef PIN_PARTITION_H
+#define PIN_PARTITION_H
+
+#include <stdlib.h>
+
+#include "dcache.h"
+
+#define MAX_CACHE_CLASSES 16
+
+/*!
+ *  @brief Classes of service with way masks, like CAT and CMT
+ *
+ *  Every access is made on behalf of a class: the class of the routine
+ *  its instruction belongs to, else the class of its thread, else class
+ *  0. A fill, by a demand miss or an install from above, may only replace
+ *  a way in the class's mask; a hit finds the line in any way.
+ *
+ *  The owner of each block lives in a side array indexed like the level's
+ *  blocks, so the occupancy of a class is counted up on a fill and down
+ *  when the line leaves, without ever scanning the level. Misses are the
+ *  demand fills. The block notifications are passed on to another
+ *  observer, so dead blocks can be followed at the same time.
+ */
+class CACHE_PARTITION : public BLOCK_OBSERVER, public WAY_ALLOCATION
+{
+private:
+    typedef struct
+    {
+        UINT64 mask;
+        CACHE_STATS hits;
+        CACHE_STATS misses;
+        CACHE_STATS installs;
+        UINT64 occupancy;
+        UINT64 peak;
+    } CLASS;
+
+    static const UINT8 EMPTY = 0xff;
+
+    const UINT32 _associativity;
+    UINT8 * _owners;
+    BLOCK_OBSERVER * _next;
+
+    CLASS _classes[MAX_CACHE_CLASSES];
+    std::vector<INT32> _threadClasses;      // by thread ID, -1 if not mapped
+    std::vector<INT32> _instClasses;        // by instruction ID
+    std::map<string, UINT32> _routines;
+    UINT32 _class;                          // of the access in progress
+
+    VOID Leave(UINT32 block);
+
+public:
+    CACHE_PARTITION(UINT32 numBlocks, UINT32 associativity);
+
+    /// Pass the block notifications on to observer as well
+    VOID SetNext(BLOCK_OBSERVER * observer) { _next = observer; }
+
+    // configuration, given as class:mask, tid:class and routine:class
+    // @return false if the setting can not be parsed
+    bool SetMask(const string & setting);
+    bool MapThread(const string & setting);
+    bool MapRoutine(const string & setting);
+
+    /// Instrumentation time, remembers the class of the instruction's routine
+    VOID MapInstruction(UINT32 instId, RTN rtn);
+
+    /// Accesses from now on are made by the instruction on thread tid
+    VOID SetAccess(THREADID tid, UINT32 instId)
+    {
+        if (instId < _instClasses.size() && _instClasses[instId] >= 0)
+            _class = _instClasses[instId];
+        else
+            SetThread(tid);
+    }
+    /// As above, without an instruction
+    VOID SetThread(THREADID tid)
+    {
+        _class = (tid < _threadClasses.size() && _threadClasses[tid] >= 0) ? _threadClasses[tid] : 0;
+    }
+
+    UINT64 FillMask() const { return _classes[_class].mask; }
+
+    VOID Hit(UINT32 block);
+    VOID Fill(UINT32 block, bool demand);
+    VOID Evict(UINT32 block, bool dirty);
+
+    string StatsLong(string prefix = "") const;
+};
+
+CACHE_PARTITION::CACHE_PARTITION(UINT32 numBlocks, UINT32 associativity)
+        : _associativity(associativity),
+          _next(NULL),
+          _class(0)
+{
+    _owners = new UINT8[numBlocks];
+    memset(_owners, EMPTY, numBlocks);
+
+    memset(_classes, 0, sizeof(_classes));
+    for (UINT32 c = 0; c < MAX_CACHE_CLASSES; c++)
+        _classes[c].mask = ~UINT64(0);
+}
+
+bool CACHE_PARTITION::SetMask(const string & setting)
+{
+    char * end;
+    const UINT32 c = strtoul(setting.c_str(), &end, 10);
+    if (*end != ':' || end == setting.c_str() || c >= MAX_CACHE_CLASSES)
+        return false;
+
+    const char * mask = end + 1;
+    const UINT64 value = strtoull(mask, &end, 16);
+    if (end == mask || *end != 0)
+        return false;
+
+    // at least one way of the level
+    const UINT64 ways = (_associativity >= 64) ? ~UINT64(0) : (UINT64(1) << _associativity) - 1;
+    if ((value & ways) == 0)
+        return false;
+
+    _classes[c].mask = value;
+    return true;
+}
+
+bool CACHE_PARTITION::MapThread(const string & setting)
+{
+    char * end;
+    const UINT32 tid = strtoul(setting.c_str(), &end, 10);
+    if (*end != ':' || end == setting.c_str())
+        return false;
+
+    const char * value = end + 1;
+    const UINT32 c = strtoul(value, &end, 10);
+    if (end == value || *end != 0 || c >= MAX_CACHE_CLASSES)
+        return false;
+
+    if (tid >= _threadClasses.size())
+        _threadClasses.resize(tid + 1, -1);
+    _threadClasses[tid] = c;
+    return true;
+}
+
+bool CACHE_PARTITION::MapRoutine(const string & setting)
+{
+    // C++ names have colons of their own
+    const size_t split = setting.rfind(':');
+    if (split == string::npos || split == 0)
+        return false;
+
+    const char * value = setting.c_str() + split + 1;
+    char * end;
+    const UINT32 c = strtoul(value, &end, 10);
+    if (end == value || *end != 0 || c >= MAX_CACHE_CLASSES)
+        return false;
+
+    _routines[setting.substr(0, split)] = c;
+    return true;
+}
+
+VOID CACHE_PARTITION::MapInstruction(UINT32 instId, RTN rtn)
+{
+    if (_routines.empty() || !RTN_Valid(rtn))
+        return;
+
+    std::map<string, UINT32>::const_iterator it = _routines.find(RTN_Name(rtn));
+    if (it == _routines.end())
+        return;
+
+    if (instId >= _instClasses.size())
+        _instClasses.resize(instId + 1, -1);
+    _instClasses[instId] = it->second;
+}
+
+VOID CACHE_PARTITION::Leave(UINT32 block)
+{
+    const UINT8 owner = _owners[block];
+    if (owner == EMPTY)
+        return;
+
+    _classes[owner].occupancy--;
+    _owners[block] = EMPTY;
+}
+
+VOID CACHE_PARTITION::Hit(UINT32 block)
+{
+    _classes[_class].hits++;
+
+    if (_next != NULL)
+        _next->Hit(block);
+}
+
+VOID CACHE_PARTITION::Fill(UINT32 block, bool demand)
+{
+    CLASS & c = _classes[_class];
+
+    Leave(block);
+    _owners[block] = _class;
+    c.occupancy++;
+    c.peak = std::max(c.peak, c.occupancy);
+    demand ? c.misses++ : c.installs++;
+
+    if (_next != NULL)
+        _next->Fill(block, demand);
+}
+
+VOID CACHE_PARTITION::Evict(UINT32 block, bool dirty)
+{
+    Leave(block);
+
+    if (_next != NULL)
+        _next->Evict(block, dirty);
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string CACHE_PARTITION::StatsLong(string prefix) const
+{
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + ljstr("class", 6) + ljstr("mask", 19)
+           + "        hits      misses   miss%    installs   occupancy        peak\n";
+    for (UINT32 c = 0; c < MAX_CACHE_CLASSES; c++)
+    {
+        const CLASS & cls = _classes[c];
+        if (cls.hits + cls.misses + cls.installs == 0)
+            continue;
+
+        const CACHE_STATS accesses = cls.hits + cls.misses;
+        out += prefix + ljstr(decstr(c), 6) + ljstr("0x" + hexstr(cls.mask), 19)
+               + mydecstr(cls.hits, numberWidth)
+               + mydecstr(cls.misses, numberWidth)
+               + "  " + fltstr(accesses ? 100.0 * cls.misses / accesses : 0.0, 2, 6) + "%"
+               + mydecstr(cls.installs, numberWidth)
+               + mydecstr(cls.occupancy, numberWidth)
+               + mydecstr(cls.peak, numberWidth) + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_PARTITION_H
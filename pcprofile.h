@@ -0,0 +1,265 @@
+/*! @file
+ *  This file contains the per instruction counter profile
+ */
+
+#ifndef PIN_PCPROFILE_H
+#define PIN_PCPROFILE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "dcache.h"
+
+#define PC_PROFILE_CHUNK_SHIFT 12
+#define PC_PROFILE_CHUNK_ROWS (1 << PC_PROFILE_CHUNK_SHIFT)
+#define PC_PROFILE_MAX_CHUNKS 1024      // 4M distinct instructions
+#define PC_PROFILE_MAX_THREADS 1024
+
+/*!
+ *  @brief Counters per static instruction, kept per thread
+ *
+ *  Instructions get dense IDs at instrumentation time, which is also when
+ *  they are symbolized. At analysis time a counter is found by indexing
+ *  the thread's chunk table with the ID, no map is searched. Every row
+ *  fills one cache line, so no two instructions share a line and no two
+ *  threads ever write the same line. The threads are summed up for the
+ *  report, which lists the instructions with the most events of one
+ *  counter first.
+ */
+template <UINT32 NUM>
+class PC_PROFILE
+{
+private:
+    typedef struct
+    {
+        UINT64 counters[NUM];
+    } __attribute__((aligned(64))) ROW;
+
+    typedef struct
+    {
+        ROW * chunks[PC_PROFILE_MAX_CHUNKS];
+    } THREAD;
+
+    typedef struct
+    {
+        ADDRINT iaddr;
+        UINT32 function;        // index into _strings
+        UINT32 file;
+        INT32 line;
+    } INSTRUCTION;
+
+    THREAD * _threads[PC_PROFILE_MAX_THREADS];
+    std::unordered_map<ADDRINT, UINT32> _ids;
+    std::vector<INSTRUCTION> _instructions;
+    std::vector<string> _strings;
+    std::unordered_map<string, UINT32> _stringIds;
+
+    string _counterNames[NUM];
+    UINT64 _threshold[NUM];
+    UINT32 _sortCounter;
+    UINT32 _top;
+
+    UINT32 StringId(const string & s);
+    ROW * AddChunk(THREADID tid, UINT32 id);
+
+public:
+    PC_PROFILE();
+
+    VOID SetCounterName(UINT32 counter, string name) { _counterNames[counter] = name; }
+    /// Report an instruction only if one of its counters exceeds its threshold
+    VOID SetThreshold(UINT32 counter, UINT64 threshold) { _threshold[counter] = threshold; }
+    /// Sort the report by counter and cut it after top rows, 0 for all
+    VOID SetOrder(UINT32 counter, UINT32 top) { _sortCounter = counter; _top = top; }
+
+    /// Dense ID of the instruction at iaddr, only at instrumentation time
+    UINT32 Map(ADDRINT iaddr);
+
+    inline UINT64 * Row(THREADID tid, UINT32 id)
+    {
+        ASSERTX(tid < PC_PROFILE_MAX_THREADS);
+
+        THREAD * thread = _threads[tid];
+        ROW * chunk = (thread != NULL) ? thread->chunks[id >> PC_PROFILE_CHUNK_SHIFT] : NULL;
+        if (chunk == NULL)
+            chunk = AddChunk(tid, id);
+        return chunk[id & (PC_PROFILE_CHUNK_ROWS - 1)].counters;
+    }
+
+    const string & CounterName(UINT32 counter) const { return _counterNames[counter]; }
+    UINT32 NumInstructions() const { return _instructions.size(); }
+    ADDRINT Address(UINT32 id) const { return _instructions[id].iaddr; }
+    /// Function and source line of an instruction, for reports
+    string Location(UINT32 id) const;
+
+    /// Counters of every instruction summed over the threads, NUM per ID
+    VOID Totals(std::vector<UINT64> & totals) const;
+
+    string StringLong(string prefix = "") const;
+};
+
+template <UINT32 NUM>
+PC_PROFILE<NUM>::PC_PROFILE()
+        : _sortCounter(0),
+          _top(0)
+{
+    for (UINT32 i = 0; i < PC_PROFILE_MAX_THREADS; i++)
+        _threads[i] = NULL;
+    for (UINT32 c = 0; c < NUM; c++)
+        _threshold[c] = 0;
+}
+
+template <UINT32 NUM>
+UINT32 PC_PROFILE<NUM>::StringId(const string & s)
+{
+    std::unordered_map<string, UINT32>::iterator it = _stringIds.find(s);
+    if (it != _stringIds.end())
+        return it->second;
+
+    _strings.push_back(s);
+    _stringIds[s] = _strings.size() - 1;
+    return _strings.size() - 1;
+}
+
+template <UINT32 NUM>
+UINT32 PC_PROFILE<NUM>::Map(ADDRINT iaddr)
+{
+    std::unordered_map<ADDRINT, UINT32>::iterator it = _ids.find(iaddr);
+    if (it != _ids.end())
+        return it->second;
+
+    ASSERTX(_instructions.size() < PC_PROFILE_MAX_CHUNKS * PC_PROFILE_CHUNK_ROWS);
+
+    // images may be gone by fini, symbolize while the code is mapped
+    INT32 column = 0;
+    INT32 line = 0;
+    string file;
+    PIN_GetSourceLocation(iaddr, &column, &line, &file);
+
+    INSTRUCTION instruction;
+    instruction.iaddr = iaddr;
+    instruction.function = StringId(RTN_FindNameByAddress(iaddr));
+    instruction.file = StringId(file);
+    instruction.line = line;
+    _instructions.push_back(instruction);
+
+    const UINT32 id = _instructions.size() - 1;
+    _ids[iaddr] = id;
+    return id;
+}
+
+/*!
+ *  @brief Slow path of Row(), only ever called by the thread owning tid
+ */
+template <UINT32 NUM>
+typename PC_PROFILE<NUM>::ROW * PC_PROFILE<NUM>::AddChunk(THREADID tid, UINT32 id)
+{
+    ASSERTX(tid < PC_PROFILE_MAX_THREADS);
+
+    if (_threads[tid] == NULL)
+    {
+        THREAD * thread = new THREAD;
+        memset(thread, 0, sizeof(THREAD));
+        _threads[tid] = thread;
+    }
+
+    VOID * chunk;
+    if (posix_memalign(&chunk, 64, PC_PROFILE_CHUNK_ROWS * sizeof(ROW)) != 0)
+        ASSERTX(false);
+    memset(chunk, 0, PC_PROFILE_CHUNK_ROWS * sizeof(ROW));
+
+    _threads[tid]->chunks[id >> PC_PROFILE_CHUNK_SHIFT] = static_cast<ROW *>(chunk);
+    return static_cast<ROW *>(chunk);
+}
+
+template <UINT32 NUM>
+VOID PC_PROFILE<NUM>::Totals(std::vector<UINT64> & totals) const
+{
+    totals.assign(_instructions.size() * NUM, 0);
+    for (UINT32 t = 0; t < PC_PROFILE_MAX_THREADS; t++)
+    {
+        if (_threads[t] == NULL)
+            continue;
+
+        for (UINT32 id = 0; id < _instructions.size(); id++)
+        {
+            const ROW * chunk = _threads[t]->chunks[id >> PC_PROFILE_CHUNK_SHIFT];
+            if (chunk == NULL)
+                continue;
+            for (UINT32 c = 0; c < NUM; c++)
+                totals[id * NUM + c] += chunk[id & (PC_PROFILE_CHUNK_ROWS - 1)].counters[c];
+        }
+    }
+}
+
+template <UINT32 NUM>
+string PC_PROFILE<NUM>::Location(UINT32 id) const
+{
+    const INSTRUCTION & instruction = _instructions[id];
+    const string & function = _strings[instruction.function];
+    const string & file = _strings[instruction.file];
+
+    string out = function.empty() ? string("?") : function;
+    if (!file.empty())
+        out += "  " + file + ":" + decstr(instruction.line);
+    return out;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+template <UINT32 NUM>
+string PC_PROFILE<NUM>::StringLong(string prefix) const
+{
+    const UINT32 numberWidth = 14;
+
+    std::vector<UINT64> totals;
+    Totals(totals);
+
+    std::vector<std::pair<UINT64, UINT32> > order;
+    UINT64 sum[NUM];
+    for (UINT32 c = 0; c < NUM; c++)
+        sum[c] = 0;
+
+    for (UINT32 id = 0; id < _instructions.size(); id++)
+    {
+        bool report = false;
+        for (UINT32 c = 0; c < NUM; c++)
+        {
+            sum[c] += totals[id * NUM + c];
+            report |= totals[id * NUM + c] > _threshold[c];
+        }
+        if (report)
+            order.push_back(std::make_pair(totals[id * NUM + _sortCounter], id));
+    }
+    std::sort(order.begin(), order.end(), std::greater<std::pair<UINT64, UINT32> >());
+    if (_top != 0 && order.size() > _top)
+        order.resize(_top);
+
+    string out;
+
+    out += prefix + ljstr("rank", 6) + ljstr("iaddr", 19);
+    for (UINT32 c = 0; c < NUM; c++)
+        out += std::string(numberWidth - std::min<size_t>(numberWidth - 1, _counterNames[c].size()), ' ')
+               + _counterNames[c];
+    out += "  function  source\n";
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const UINT32 id = order[i].second;
+
+        out += prefix + ljstr(decstr(i + 1), 6) + ljstr("0x" + hexstr(_instructions[id].iaddr), 19);
+        for (UINT32 c = 0; c < NUM; c++)
+            out += mydecstr(totals[id * NUM + c], numberWidth);
+        out += "  " + Location(id) + "\n";
+    }
+
+    out += prefix + ljstr("total", 25);
+    for (UINT32 c = 0; c < NUM; c++)
+        out += mydecstr(sum[c], numberWidth);
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_PCPROFILE_H
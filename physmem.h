@@ -0,0 +1,381 @@
+/*! @file
+ *  This file contains the simulated physical memory that maps the
+ *  addresses below the L1 caches
+ */
+
+#ifndef PIN_PHYSMEM_H
+#define PIN_PHYSMEM_H
+
+#include <unordered_map>
+
+#include "dcache.h"
+#include "tlb.h"
+
+#define PHYS_PAGE_SHIFT 12
+#define PHYS_HUGE_SHIFT 21
+#define PHYS_HUGE_FRAMES (1 << (PHYS_HUGE_SHIFT - PHYS_PAGE_SHIFT))
+#define PHYS_CACHE_ENTRIES 256
+
+namespace PHYS_POLICY
+{
+    // which free 4K frame a first touch gets
+    typedef enum
+    {
+        SEQUENTIAL,     // the lowest free frame
+        RANDOM,         // any free frame, like a long running system
+        COLORED         // a frame of the page's color in the L2
+    } POLICY;
+}
+
+namespace PHYS_THP
+{
+    // when a 2M virtual region is backed by a huge frame
+    typedef enum
+    {
+        NEVER,
+        ALWAYS,         // at the first touch, if a free 2M frame is left
+        COLLAPSE        // once enough of its 4K pages were touched
+    } POLICY;
+}
+
+/*!
+ *  @brief First touch physical page allocator
+ *
+ *  L1 caches are indexed with virtual addresses, every level below them
+ *  and the trace get the physical ones. Memory is a pool of 2M blocks,
+ *  a block is either handed out whole as a huge page or split into 4K
+ *  frames. Split blocks never merge again, so huge pages get scarce as
+ *  memory fragments. Frames are never freed; once memory is full, pages
+ *  get frames past its end, counted as overflow, so a run is not cut
+ *  short. Translations are looked up in a small direct mapped array
+ *  before the page tables.
+ */
+class PHYSICAL_MEMORY : public ADDRESS_TRANSLATION
+{
+private:
+    typedef struct
+    {
+        UINT32 block;
+        UINT32 touched;         // 4K pages mapped in the region
+        bool huge;
+    } REGION;
+
+    typedef struct
+    {
+        ADDRINT vpn;
+        ADDRINT pfn;
+    } ENTRY;
+
+    const PHYS_POLICY::POLICY _policy;
+    const PHYS_THP::POLICY _thp;
+    const UINT32 _colors;
+    const UINT32 _collapseThreshold;
+    UINT64 _random;
+
+    std::vector<UINT32> _freeBlocks;                    // lowest last
+    std::vector<std::vector<ADDRINT> > _freeFrames;     // per color, lowest last
+    ADDRINT _overflowFrame;                             // next frame past the end of memory
+
+    std::unordered_map<ADDRINT, ADDRINT> _pages;        // vpn -> pfn
+    std::unordered_map<ADDRINT, ADDRINT> _owners;       // pfn -> vpn
+    std::unordered_map<ADDRINT, REGION> _regions;       // 2M virtual region
+    std::unordered_map<UINT32, ADDRINT> _hugeOwners;    // block -> region
+    ENTRY _cache[PHYS_CACHE_ENTRIES];
+
+    // level the dropped lines of collapsed pages are invalidated in
+    CACHE_LEVEL * _level;
+
+    CACHE_STATS _smallPages;
+    CACHE_STATS _hugePages;
+    CACHE_STATS _collapses;
+    CACHE_STATS _droppedLines;
+    CACHE_STATS _droppedDirty;
+    CACHE_STATS _colorFallbacks;
+    CACHE_STATS _overflowFrames;
+
+    UINT64 Random(UINT64 n);
+    UINT32 TakeBlock();
+    ADDRINT TakeFrame(ADDRINT vpn);
+    VOID Collapse(ADDRINT region, REGION & r);
+    ADDRINT Map(ADDRINT vpn);
+
+public:
+    PHYSICAL_MEMORY(UINT64 size, PHYS_POLICY::POLICY policy, UINT32 colors,
+                    PHYS_THP::POLICY thp, UINT32 collapseThreshold);
+
+    /// Level whose copies of collapsed pages are dropped
+    VOID SetLevel(CACHE_LEVEL * level) { _level = level; }
+
+    ADDRINT Physical(ADDRINT addr)
+    {
+        // page walks already read physical page table entries
+        if (addr >= PAGE_TABLE_BASE)
+            return addr;
+
+        const ADDRINT vpn = addr >> PHYS_PAGE_SHIFT;
+        ENTRY & entry = _cache[vpn & (PHYS_CACHE_ENTRIES - 1)];
+        if (entry.vpn != vpn)
+        {
+            entry.pfn = Map(vpn);
+            entry.vpn = vpn;
+        }
+        return (entry.pfn << PHYS_PAGE_SHIFT) | (addr & ((1 << PHYS_PAGE_SHIFT) - 1));
+    }
+
+    bool Virtual(ADDRINT addr, ADDRINT & vaddr) const;
+
+    string StatsLong(string prefix = "") const;
+};
+
+PHYSICAL_MEMORY::PHYSICAL_MEMORY(UINT64 size, PHYS_POLICY::POLICY policy, UINT32 colors,
+                                 PHYS_THP::POLICY thp, UINT32 collapseThreshold)
+        : _policy(policy),
+          _thp(thp),
+          _colors(policy == PHYS_POLICY::COLORED ? colors : 1),
+          _collapseThreshold(collapseThreshold),
+          _random(0x9E3779B97F4A7C15ULL),
+          _freeFrames(_colors),
+          _level(NULL),
+          _smallPages(0),
+          _hugePages(0),
+          _collapses(0),
+          _droppedLines(0),
+          _droppedDirty(0),
+          _colorFallbacks(0),
+          _overflowFrames(0)
+{
+    ASSERTX(_colors != 0 && _colors <= PHYS_HUGE_FRAMES);
+
+    const UINT32 blocks = size >> PHYS_HUGE_SHIFT;
+    for (UINT32 block = blocks; block > 0; block--)
+        _freeBlocks.push_back(block - 1);
+    _overflowFrame = ADDRINT(blocks) * PHYS_HUGE_FRAMES;
+
+    for (UINT32 i = 0; i < PHYS_CACHE_ENTRIES; i++)
+        _cache[i].vpn = ~ADDRINT(0);
+}
+
+/// xorshift64*, the same placement on every run
+UINT64 PHYSICAL_MEMORY::Random(UINT64 n)
+{
+    _random ^= _random >> 12;
+    _random ^= _random << 25;
+    _random ^= _random >> 27;
+    return (_random * 2685821657736338717ULL) % n;
+}
+
+UINT32 PHYSICAL_MEMORY::TakeBlock()
+{
+    ASSERTX(!_freeBlocks.empty());
+
+    if (_policy == PHYS_POLICY::RANDOM)
+        std::swap(_freeBlocks[Random(_freeBlocks.size())], _freeBlocks.back());
+
+    const UINT32 block = _freeBlocks.back();
+    _freeBlocks.pop_back();
+    return block;
+}
+
+ADDRINT PHYSICAL_MEMORY::TakeFrame(ADDRINT vpn)
+{
+    std::vector<ADDRINT> * frames = &_freeFrames[vpn % _colors];
+
+    if (frames->empty() && !_freeBlocks.empty())
+    {
+        const ADDRINT first = ADDRINT(TakeBlock()) * PHYS_HUGE_FRAMES;
+        for (ADDRINT pfn = first + PHYS_HUGE_FRAMES; pfn > first; pfn--)
+            _freeFrames[(pfn - 1) % _colors].push_back(pfn - 1);
+    }
+
+    // once the blocks are gone a color can run dry before the others
+    if (frames->empty())
+    {
+        for (UINT32 color = 0; frames->empty() && color < _colors; color++)
+            frames = &_freeFrames[color];
+        if (!frames->empty())
+            _colorFallbacks++;
+    }
+
+    // simulated memory is full, keep going past its end
+    if (frames->empty())
+    {
+        if (_overflowFrames++ == 0)
+            cerr << "warning: simulated physical memory is full, raise -phys_mb; "
+                 << "further pages are mapped past its end" << endl;
+        return _overflowFrame++;
+    }
+
+    if (_policy == PHYS_POLICY::RANDOM)
+        std::swap((*frames)[Random(frames->size())], frames->back());
+
+    const ADDRINT pfn = frames->back();
+    frames->pop_back();
+    return pfn;
+}
+
+/*!
+ *  @brief Move the 4K pages of a region into a huge frame
+ *
+ *  The copy itself is not simulated. Lines of the old frames are dropped
+ *  from the physical levels, so nothing below L1 holds a stale address
+ *  when the frames are handed out again; modified ones are written back
+ *  first, the copy reads them from memory.
+ */
+VOID PHYSICAL_MEMORY::Collapse(ADDRINT region, REGION & r)
+{
+    r.block = TakeBlock();
+    r.huge = true;
+    _hugeOwners[r.block] = region;
+
+    for (ADDRINT offset = 0; offset < PHYS_HUGE_FRAMES; offset++)
+    {
+        std::unordered_map<ADDRINT, ADDRINT>::iterator it = _pages.find(region * PHYS_HUGE_FRAMES + offset);
+        if (it == _pages.end())
+            continue;
+
+        const ADDRINT pfn = it->second;
+        if (_level != NULL)
+        {
+            for (ADDRINT addr = pfn << PHYS_PAGE_SHIFT; addr < (pfn + 1) << PHYS_PAGE_SHIFT;
+                 addr += _level->LineSize())
+            {
+                bool dirty;
+                if (!_level->Invalidate(addr, dirty))
+                    continue;
+
+                _droppedLines++;
+                if (dirty)
+                {
+                    _level->WriteMemory(addr);
+                    _droppedDirty++;
+                }
+            }
+        }
+
+        _owners.erase(pfn);
+        _pages.erase(it);
+        _freeFrames[pfn % _colors].push_back(pfn);
+        _smallPages--;
+    }
+
+    for (UINT32 i = 0; i < PHYS_CACHE_ENTRIES; i++)
+    {
+        if ((_cache[i].vpn >> (PHYS_HUGE_SHIFT - PHYS_PAGE_SHIFT)) == region)
+            _cache[i].vpn = ~ADDRINT(0);
+    }
+
+    _collapses++;
+    _hugePages++;
+}
+
+/*!
+ *  @brief Slow path of Physical(), maps the page on its first touch
+ */
+ADDRINT PHYSICAL_MEMORY::Map(ADDRINT vpn)
+{
+    const ADDRINT region = vpn / PHYS_HUGE_FRAMES;
+    const ADDRINT offset = vpn % PHYS_HUGE_FRAMES;
+
+    REGION * r = NULL;
+    if (_thp != PHYS_THP::NEVER)
+    {
+        std::unordered_map<ADDRINT, REGION>::iterator it = _regions.find(region);
+        if (it == _regions.end())
+        {
+            REGION fresh = { 0, 0, false };
+            it = _regions.insert(std::make_pair(region, fresh)).first;
+        }
+        r = &it->second;
+
+        if (!r->huge && r->touched == 0 && _thp == PHYS_THP::ALWAYS && !_freeBlocks.empty())
+        {
+            r->block = TakeBlock();
+            r->huge = true;
+            _hugeOwners[r->block] = region;
+            _hugePages++;
+        }
+        if (r->huge)
+            return ADDRINT(r->block) * PHYS_HUGE_FRAMES + offset;
+    }
+
+    std::unordered_map<ADDRINT, ADDRINT>::iterator it = _pages.find(vpn);
+    if (it != _pages.end())
+        return it->second;
+
+    const ADDRINT pfn = TakeFrame(vpn);
+    _pages[vpn] = pfn;
+    _owners[pfn] = vpn;
+    _smallPages++;
+
+    if (r != NULL && ++r->touched >= _collapseThreshold &&
+        _thp == PHYS_THP::COLLAPSE && !_freeBlocks.empty())
+    {
+        Collapse(region, *r);
+        return ADDRINT(r->block) * PHYS_HUGE_FRAMES + offset;
+    }
+
+    return pfn;
+}
+
+bool PHYSICAL_MEMORY::Virtual(ADDRINT addr, ADDRINT & vaddr) const
+{
+    if (addr >= PAGE_TABLE_BASE)
+    {
+        vaddr = addr;
+        return true;
+    }
+
+    const ADDRINT pfn = addr >> PHYS_PAGE_SHIFT;
+
+    std::unordered_map<UINT32, ADDRINT>::const_iterator huge = _hugeOwners.find(pfn / PHYS_HUGE_FRAMES);
+    if (huge != _hugeOwners.end())
+    {
+        vaddr = (huge->second << PHYS_HUGE_SHIFT) | (addr & ((1 << PHYS_HUGE_SHIFT) - 1));
+        return true;
+    }
+
+    std::unordered_map<ADDRINT, ADDRINT>::const_iterator it = _owners.find(pfn);
+    if (it == _owners.end())
+        return false;
+
+    vaddr = (it->second << PHYS_PAGE_SHIFT) | (addr & ((1 << PHYS_PAGE_SHIFT) - 1));
+    return true;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string PHYSICAL_MEMORY::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + ljstr("Colors:          ", headerWidth)
+           + mydecstr(_colors, numberWidth) + "\n";
+    out += prefix + ljstr("Pages-4K:        ", headerWidth)
+           + mydecstr(_smallPages, numberWidth) + "\n";
+    out += prefix + ljstr("Pages-2M:        ", headerWidth)
+           + mydecstr(_hugePages, numberWidth) + "\n";
+    out += prefix + ljstr("Collapses:       ", headerWidth)
+           + mydecstr(_collapses, numberWidth) + "\n";
+    out += prefix + ljstr("Dropped-Lines:   ", headerWidth)
+           + mydecstr(_droppedLines, numberWidth) + "\n";
+    out += prefix + ljstr("Dropped-Dirty:   ", headerWidth)
+           + mydecstr(_droppedDirty, numberWidth) + "\n";
+    out += prefix + ljstr("Color-Fallbacks: ", headerWidth)
+           + mydecstr(_colorFallbacks, numberWidth) + "\n";
+    out += prefix + ljstr("Overflow-Pages:  ", headerWidth)
+           + mydecstr(_overflowFrames, numberWidth) + "\n";
+    out += prefix + ljstr("Footprint-MB:    ", headerWidth)
+           + mydecstr(((_smallPages << PHYS_PAGE_SHIFT) + (_hugePages << PHYS_HUGE_SHIFT)) >> 20,
+                      numberWidth) + "\n";
+    out += prefix + ljstr("Free-2M-Blocks:  ", headerWidth)
+           + mydecstr(_freeBlocks.size(), numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_PHYSMEM_H
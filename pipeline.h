@@ -0,0 +1,302 @@
+/*! @file
+ *  This file contains the access log that decouples application threads
+ *  from the cache simulation
+ */
+
+#ifndef PIN_PIPELINE_H
+#define PIN_PIPELINE_H
+
+#include <atomic>
+
+#include "dcache.h"
+
+#define PIPE_CHUNK_RECORDS 4096
+#define PIPE_RING_CHUNKS 8
+#define PIPE_MAX_THREADS 1024
+
+typedef enum
+{
+    PIPE_RECORD_LOAD,
+    PIPE_RECORD_STORE,
+    PIPE_RECORD_FETCH,          // addr is the first line, size the number of lines
+    PIPE_RECORD_PREFETCH,       // size is the PREFETCH_HINT
+    PIPE_RECORD_STREAM,         // non-temporal store
+    PIPE_RECORD_FENCE,          // drains the write-combining buffers
+    PIPE_RECORD_COUNT           // only carries instructions
+} PIPE_RECORD_TYPE;
+
+/*!
+ *  @brief One logged event, 16 bytes on a 64 bit host
+ */
+typedef struct
+{
+    ADDRINT addr;
+    UINT32 instId;
+    UINT16 size;
+    UINT8 type;
+    UINT8 instructions;         // instructions the thread executed since its previous record
+} PIPE_RECORD;
+
+typedef struct
+{
+    UINT64 seq;                 // global publish order
+    UINT32 count;
+    PIPE_RECORD records[PIPE_CHUNK_RECORDS];
+} PIPE_CHUNK;
+
+/*!
+ *  @brief Single producer single consumer ring of chunks owned by one
+ *  application thread
+ */
+typedef struct
+{
+    PIPE_CHUNK chunks[PIPE_RING_CHUNKS];
+    std::atomic<UINT64> head;   // chunks published by the producer
+    std::atomic<UINT64> tail;   // chunks retired by the consumer
+    UINT32 fill;                // records in chunks[head % PIPE_RING_CHUNKS]
+    UINT32 pending;             // instructions not yet attached to a record
+} PIPE_RING;
+
+/*!
+ *  @brief Access log between application threads and the simulator
+ *
+ *  Application threads only append records to their own ring. A full chunk
+ *  gets the next global sequence number when it is published and the
+ *  simulator replays chunks strictly in sequence order, so a run replays
+ *  the exact interleaving (at chunk granularity) the threads published.
+ *
+ *  The simulator runs on a Pin internal thread until Stop(). After that,
+ *  a producer that finds its ring full replays chunks itself and Drain()
+ *  replays everything left, including partially filled chunks.
+ */
+class PIPELINE
+{
+public:
+    typedef VOID (*CONSUMER)(THREADID tid, const PIPE_RECORD & record);
+
+private:
+    std::atomic<PIPE_RING *> _rings[PIPE_MAX_THREADS];
+    std::atomic<UINT32> _numRings;
+    std::atomic<UINT64> _seq;
+    UINT64 _next;               // next sequence number to replay
+    const CONSUMER _consumer;
+
+    std::atomic<bool> _stop;
+    std::atomic<bool> _stopped;
+    PIN_THREAD_UID _simulatorUid;
+    PIN_LOCK _replayLock;
+
+    VOID Publish(PIPE_RING * ring);
+    VOID WaitForSlot(PIPE_RING * ring);
+    bool Replay();
+
+    static VOID Simulator(VOID * v);
+
+public:
+    PIPELINE(CONSUMER consumer);
+
+    /// Create the ring of a new application thread
+    VOID ThreadStart(THREADID tid);
+
+    /// Publish whatever the thread logged so far
+    VOID Flush(THREADID tid);
+
+    inline VOID Count(THREADID tid)
+    {
+        PIPE_RING * ring = _rings[tid].load(std::memory_order_relaxed);
+        if (++ring->pending == 255)
+            Push(tid, 0, 0, PIPE_RECORD_COUNT, 0);
+    }
+
+    inline VOID Push(THREADID tid, ADDRINT addr, UINT32 size, PIPE_RECORD_TYPE type, UINT32 instId)
+    {
+        PIPE_RING * ring = _rings[tid].load(std::memory_order_relaxed);
+        PIPE_RECORD & record = ring->chunks[ring->head.load(std::memory_order_relaxed) % PIPE_RING_CHUNKS]
+                               .records[ring->fill];
+        record.addr = addr;
+        record.instId = instId;
+        record.size = size;
+        record.type = type;
+        record.instructions = ring->pending;
+        ring->pending = 0;
+
+        if (++ring->fill == PIPE_CHUNK_RECORDS)
+            Publish(ring);
+    }
+
+    /// Start the simulator thread
+    BOOL Start();
+
+    /// Stop the simulator thread, to be called while preparing for fini
+    VOID Stop();
+
+    /// Replay everything that is left, to be called from fini
+    VOID Drain();
+};
+
+PIPELINE::PIPELINE(CONSUMER consumer)
+        : _numRings(0),
+          _seq(0),
+          _next(0),
+          _consumer(consumer),
+          _stop(false),
+          _stopped(false),
+          _simulatorUid(0)
+{
+    for (UINT32 i = 0; i < PIPE_MAX_THREADS; i++)
+        _rings[i] = NULL;
+    PIN_InitLock(&_replayLock);
+}
+
+VOID PIPELINE::ThreadStart(THREADID tid)
+{
+    ASSERTX(tid < PIPE_MAX_THREADS);
+
+    // a recycled thread ID keeps the ring, its previous owner flushed it
+    if (_rings[tid].load() != NULL)
+        return;
+
+    PIPE_RING * ring = new PIPE_RING;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->fill = 0;
+    ring->pending = 0;
+    _rings[tid] = ring;
+
+    // the simulator scans rings [0, _numRings)
+    UINT32 numRings = _numRings.load();
+    while (numRings <= tid && !_numRings.compare_exchange_weak(numRings, tid + 1))
+        ;
+}
+
+VOID PIPELINE::Publish(PIPE_RING * ring)
+{
+    const UINT64 head = ring->head.load(std::memory_order_relaxed);
+    PIPE_CHUNK & chunk = ring->chunks[head % PIPE_RING_CHUNKS];
+
+    chunk.count = ring->fill;
+    chunk.seq = _seq.fetch_add(1);
+    ring->head.store(head + 1, std::memory_order_release);
+    ring->fill = 0;
+
+    WaitForSlot(ring);
+}
+
+VOID PIPELINE::WaitForSlot(PIPE_RING * ring)
+{
+    const UINT64 head = ring->head.load(std::memory_order_relaxed);
+
+    while (head - ring->tail.load(std::memory_order_acquire) >= PIPE_RING_CHUNKS)
+    {
+        if (_stopped.load())
+        {
+            PIN_GetLock(&_replayLock, PIN_ThreadId() + 1);
+            Replay();
+            PIN_ReleaseLock(&_replayLock);
+        }
+        else
+        {
+            PIN_Yield();
+        }
+    }
+}
+
+VOID PIPELINE::Flush(THREADID tid)
+{
+    PIPE_RING * ring = _rings[tid].load(std::memory_order_relaxed);
+    if (ring->pending != 0)
+        Push(tid, 0, 0, PIPE_RECORD_COUNT, 0);
+    if (ring->fill != 0)
+        Publish(ring);
+}
+
+/*!
+ *  @brief Replay the chunk with the next sequence number if it is published
+ */
+bool PIPELINE::Replay()
+{
+    const UINT32 numRings = _numRings.load();
+
+    for (UINT32 tid = 0; tid < numRings; tid++)
+    {
+        PIPE_RING * ring = _rings[tid].load(std::memory_order_acquire);
+        if (ring == NULL)
+            continue;
+
+        const UINT64 tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail == ring->head.load(std::memory_order_acquire))
+            continue;
+
+        const PIPE_CHUNK & chunk = ring->chunks[tail % PIPE_RING_CHUNKS];
+        if (chunk.seq != _next)
+            continue;
+
+        for (UINT32 i = 0; i < chunk.count; i++)
+            _consumer(tid, chunk.records[i]);
+
+        ring->tail.store(tail + 1, std::memory_order_release);
+        _next++;
+        return true;
+    }
+
+    return false;
+}
+
+VOID PIPELINE::Simulator(VOID * v)
+{
+    PIPELINE * pipeline = static_cast<PIPELINE *>(v);
+
+    while (!pipeline->_stop.load())
+    {
+        if (!pipeline->Replay())
+            PIN_Yield();
+    }
+    pipeline->_stopped = true;
+}
+
+BOOL PIPELINE::Start()
+{
+    return PIN_SpawnInternalThread(Simulator, this, 0, &_simulatorUid) != INVALID_THREADID;
+}
+
+VOID PIPELINE::Stop()
+{
+    _stop = true;
+    PIN_WaitForThreadTermination(_simulatorUid, PIN_INFINITE_TIMEOUT, NULL);
+    _stopped = true;
+}
+
+VOID PIPELINE::Drain()
+{
+    PIN_GetLock(&_replayLock, PIN_ThreadId() + 1);
+
+    while (Replay())
+        ;
+
+    // all application threads are gone, publish their leftovers in thread order
+    const UINT32 numRings = _numRings.load();
+    for (UINT32 tid = 0; tid < numRings; tid++)
+    {
+        PIPE_RING * ring = _rings[tid].load();
+        if (ring == NULL)
+            continue;
+
+        if (ring->pending != 0)
+            Push(tid, 0, 0, PIPE_RECORD_COUNT, 0);
+        if (ring->fill != 0)
+        {
+            const UINT64 head = ring->head.load(std::memory_order_relaxed);
+            PIPE_CHUNK & chunk = ring->chunks[head % PIPE_RING_CHUNKS];
+            chunk.count = ring->fill;
+            chunk.seq = _seq.fetch_add(1);
+            ring->head.store(head + 1, std::memory_order_release);
+            ring->fill = 0;
+        }
+        while (Replay())
+            ;
+    }
+
+    PIN_ReleaseLock(&_replayLock);
+}
+
+#endif // PIN_PIPELINE_H
@@ -0,0 +1,129 @@
+/*! @file
+ *  This file contains the software prefetch model
+ */
+
+#ifndef PIN_PREFETCH_H
+#define PIN_PREFETCH_H
+
+#include "dcache.h"
+
+typedef enum
+{
+    PREFETCH_HINT_T0,           // into L1
+    PREFETCH_HINT_T1,           // into L2, T2 as well without an L3
+    PREFETCH_HINT_NTA,          // into L1 like T0, there is no streaming way
+    PREFETCH_HINT_W,            // into L1 with write intent
+    PREFETCH_HINT_NUM
+} PREFETCH_HINT;
+
+static const char * const PREFETCH_HINT_NAME[PREFETCH_HINT_NUM] = { "T0", "T1", "NTA", "W" };
+
+/*!
+ *  @brief Hint of a prefetch instruction, AMD's PREFETCH goes to L1
+ */
+PREFETCH_HINT PrefetchHint(INS ins)
+{
+    const string mnemonic = INS_Mnemonic(ins);
+
+    if (mnemonic == "PREFETCHT1" || mnemonic == "PREFETCHT2")
+        return PREFETCH_HINT_T1;
+    if (mnemonic == "PREFETCHNTA")
+        return PREFETCH_HINT_NTA;
+    if (mnemonic.compare(0, 9, "PREFETCHW") == 0)
+        return PREFETCH_HINT_W;
+    return PREFETCH_HINT_T0;
+}
+
+/*!
+ *  @brief Non-blocking fills for software prefetches
+ *
+ *  A prefetch fills the hinted level like a demand access would, but it
+ *  does not stall the core: the hit and miss penalties are taken back.
+ *  Prefetches are not attributed to instructions in the memop profile.
+ */
+class SOFTWARE_PREFETCH
+{
+private:
+    CACHE_LEVEL * const _l1;
+    CACHE_LEVEL * const _l2;
+
+    CACHE_STATS _issued[PREFETCH_HINT_NUM];
+    CACHE_STATS _redundant[PREFETCH_HINT_NUM];      // the line was there already
+
+public:
+    SOFTWARE_PREFETCH(CACHE_LEVEL * l1, CACHE_LEVEL * l2);
+
+    VOID Prefetch(ADDRINT addr, PREFETCH_HINT hint);
+
+    string StatsLong(string prefix = "") const;
+};
+
+SOFTWARE_PREFETCH::SOFTWARE_PREFETCH(CACHE_LEVEL * l1, CACHE_LEVEL * l2)
+        : _l1(l1),
+          _l2(l2)
+{
+    for (UINT32 hint = 0; hint < PREFETCH_HINT_NUM; hint++)
+    {
+        _issued[hint] = 0;
+        _redundant[hint] = 0;
+    }
+}
+
+VOID SOFTWARE_PREFETCH::Prefetch(ADDRINT addr, PREFETCH_HINT hint)
+{
+    const unsigned long long int issue = ins_count;
+    trace_at_issue = true;
+    trace_issue = issue;
+
+    bool hit;
+    switch (hint)
+    {
+      case PREFETCH_HINT_T1:
+        hit = _l2->AccessSingleLine(_l1->Below(addr), ACCESS_TYPE_LOAD);
+        break;
+
+      case PREFETCH_HINT_W:
+        hit = _l1->AccessSingleLine(addr, ACCESS_TYPE_STORE);
+        break;
+
+      default:
+        hit = _l1->AccessSingleLine(addr, ACCESS_TYPE_LOAD);
+        break;
+    }
+
+    // the fill overlaps with whatever the core does next; its memory
+    // traffic went out at the issue, the penalties are taken back
+    trace_at_issue = false;
+    ins_count = issue;
+
+    _issued[hint]++;
+    _redundant[hint] += hit;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string SOFTWARE_PREFETCH::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    for (UINT32 hint = 0; hint < PREFETCH_HINT_NUM; hint++)
+    {
+        if (_issued[hint] == 0)
+            continue;
+
+        out += prefix + ljstr(string("Prefetch-") + PREFETCH_HINT_NAME[hint] + ":", headerWidth)
+               + mydecstr(_issued[hint], numberWidth) + "\n";
+        out += prefix + ljstr(string("Redundant-") + PREFETCH_HINT_NAME[hint] + ":", headerWidth)
+               + mydecstr(_redundant[hint], numberWidth) +
+               "  " + fltstr(100.0 * _redundant[hint] / _issued[hint], 2, 6) + "%\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_PREFETCH_H
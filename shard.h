@@ -0,0 +1,332 @@
+/*! @file
+ *  This file contains a last level cache whose sets are simulated in
+ *  parallel by several worker threads
+ */
+
+#ifndef PIN_SHARD_H
+#define PIN_SHARD_H
+
+#include <atomic>
+
+#include "dcache.h"
+
+#define MAX_CACHE_SHARDS 64
+#define SHARD_QUEUE_ENTRIES (64 * 1024)
+
+typedef enum
+{
+    SHARD_REQUEST_LOAD = ACCESS_TYPE_LOAD,
+    SHARD_REQUEST_STORE = ACCESS_TYPE_STORE,
+    SHARD_REQUEST_INSTALL,
+    SHARD_REQUEST_INSTALL_DIRTY
+} SHARD_REQUEST_TYPE;
+
+typedef struct
+{
+    ADDRINT addr;
+    UINT32 type;
+} SHARD_REQUEST;
+
+/*!
+ *  @brief Single producer single consumer request queue of one shard
+ */
+typedef struct
+{
+    SHARD_REQUEST requests[SHARD_QUEUE_ENTRIES];
+    std::atomic<UINT64> head;
+    std::atomic<UINT64> tail;
+} SHARD_QUEUE;
+
+/*!
+ *  @brief Counters of a slice as the worker last published them
+ */
+typedef struct
+{
+    std::atomic<CACHE_STATS> access[ACCESS_TYPE_NUM][2];
+    std::atomic<CACHE_STATS> writebacks;
+} SHARD_COUNTERS;
+
+/*!
+ *  @brief Splits the sets of a last level cache across worker threads
+ *
+ *  Shard w owns every set whose index is w modulo the number of shards and
+ *  simulates them in a slice: a cache of the same line size and
+ *  associativity with 1/N of the sets that skips the shard bits when it
+ *  picks a set. Accesses are handed to the shard's queue without waiting
+ *  for the outcome, so the level gives no timing feedback; memory traffic
+ *  is only counted. Statistics of the slices are merged into the level by
+ *  Drain(); while the run goes on, Collect() sums what the workers have
+ *  published so far into the level's access and writeback counters.
+ *
+ *  Requests must come from one thread at a time, the single-threaded
+ *  simulator of the pipelined mode or callers serialized by a lock.
+ */
+template <class CACHE_T>
+class CACHE_SHARDS : public CACHE_FORWARD
+{
+private:
+    CACHE_T * const _level;
+    const UINT32 _numShards;
+    const UINT32 _lineShift;
+
+    CACHE_T * _slices[MAX_CACHE_SHARDS];
+    SHARD_QUEUE * _queues[MAX_CACHE_SHARDS];
+    CACHE_STATS _memoryAccesses[MAX_CACHE_SHARDS];
+    SHARD_COUNTERS _counters[MAX_CACHE_SHARDS];
+    PIN_THREAD_UID _workerUids[MAX_CACHE_SHARDS];
+
+    std::atomic<bool> _stop;
+    std::atomic<bool> _stopped;
+
+    typedef struct
+    {
+        CACHE_SHARDS * shards;
+        UINT32 shard;
+    } WORKER_ARG;
+    WORKER_ARG _workerArgs[MAX_CACHE_SHARDS];
+
+    VOID Push(ADDRINT addr, UINT32 type);
+    bool Process(UINT32 shard);
+    VOID Publish(UINT32 shard);
+
+    static VOID Worker(VOID * v);
+
+public:
+    /// create makes the slices, they have a geometry of their own
+    CACHE_SHARDS(CACHE_T * level, UINT32 numShards, CACHE_FACTORY create);
+
+    VOID Access(ADDRINT addr, ACCESS_TYPE accessType) { Push(addr, accessType); }
+    VOID Install(ADDRINT addr, bool dirty)
+    {
+        Push(addr, dirty ? SHARD_REQUEST_INSTALL_DIRTY : SHARD_REQUEST_INSTALL);
+    }
+
+    /// Every slice reports its misses, from the worker threads
+    template <class LISTENER>
+    VOID SetMissListener(LISTENER listener, VOID * v)
+    {
+        for (UINT32 i = 0; i < _numShards; i++)
+            _slices[i]->setMissListener(listener, v);
+    }
+
+    /// Start the worker threads
+    BOOL Start();
+
+    /// Stop the worker threads, to be called while preparing for fini
+    VOID Stop();
+
+    /// Simulate what is still queued and merge the slices into the level
+    VOID Drain();
+
+    /// Level counters from the published ones, a STATS_REFRESH for v
+    /// pointing to the shards; the queued requests are not in there yet
+    static VOID Collect(VOID * v);
+
+    string StatsLong(string prefix = "") const;
+};
+
+template <class CACHE_T>
+CACHE_SHARDS<CACHE_T>::CACHE_SHARDS(CACHE_T * level, UINT32 numShards, CACHE_FACTORY create)
+        : _level(level),
+          _numShards(numShards),
+          _lineShift(FloorLog2(level->LineSize())),
+          _stop(false),
+          _stopped(false)
+{
+    ASSERTX(IsPower2(numShards) && numShards <= MAX_CACHE_SHARDS);
+    ASSERTX(numShards <= level->CacheSize() / (level->Associativity() * level->LineSize()));
+
+    for (UINT32 i = 0; i < numShards; i++)
+    {
+        // slices have no penalties, they must not touch the clock
+        _slices[i] = create(level->GetName() + "shard " + decstr(i) + " ",
+                            level->CacheSize() / numShards, level->LineSize(),
+                            level->Associativity(), 0, 0);
+        _slices[i]->SetIndexShift(FloorLog2(numShards));
+        _memoryAccesses[i] = 0;
+        _slices[i]->setMemoryCounter(&_memoryAccesses[i]);
+        Publish(i);
+
+        _queues[i] = new SHARD_QUEUE;
+        _queues[i]->head = 0;
+        _queues[i]->tail = 0;
+
+        _workerArgs[i].shards = this;
+        _workerArgs[i].shard = i;
+    }
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Push(ADDRINT addr, UINT32 type)
+{
+    // low set index bits pick the shard
+    const UINT32 shard = (addr >> _lineShift) & (_numShards - 1);
+    SHARD_QUEUE * queue = _queues[shard];
+    const UINT64 head = queue->head.load(std::memory_order_relaxed);
+
+    while (head - queue->tail.load(std::memory_order_acquire) >= SHARD_QUEUE_ENTRIES)
+    {
+        // once the workers are gone the producer simulates the shard itself
+        if (_stopped.load())
+            Process(shard);
+        else
+            PIN_Yield();
+    }
+
+    SHARD_REQUEST & request = queue->requests[head % SHARD_QUEUE_ENTRIES];
+    request.addr = addr;
+    request.type = type;
+    queue->head.store(head + 1, std::memory_order_release);
+}
+
+/*!
+ *  @return true if there was anything to simulate
+ */
+template <class CACHE_T>
+bool CACHE_SHARDS<CACHE_T>::Process(UINT32 shard)
+{
+    SHARD_QUEUE * queue = _queues[shard];
+    CACHE_T * slice = _slices[shard];
+
+    const UINT64 head = queue->head.load(std::memory_order_acquire);
+    UINT64 tail = queue->tail.load(std::memory_order_relaxed);
+    if (tail == head)
+        return false;
+
+    for (; tail != head; tail++)
+    {
+        const SHARD_REQUEST & request = queue->requests[tail % SHARD_QUEUE_ENTRIES];
+        switch (request.type)
+        {
+          case SHARD_REQUEST_INSTALL:
+            slice->Install(request.addr, false);
+            break;
+          case SHARD_REQUEST_INSTALL_DIRTY:
+            slice->Install(request.addr, true);
+            break;
+          default:
+            slice->AccessSingleLine(request.addr, ACCESS_TYPE(request.type));
+            break;
+        }
+    }
+    queue->tail.store(tail, std::memory_order_release);
+    Publish(shard);
+
+    return true;
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Publish(UINT32 shard)
+{
+    const CACHE_T * slice = _slices[shard];
+    SHARD_COUNTERS & counters = _counters[shard];
+
+    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+    {
+        counters.access[accessType][false].store(slice->Misses(ACCESS_TYPE(accessType)), std::memory_order_relaxed);
+        counters.access[accessType][true].store(slice->Hits(ACCESS_TYPE(accessType)), std::memory_order_relaxed);
+    }
+    counters.writebacks.store(slice->Writebacks(), std::memory_order_relaxed);
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Collect(VOID * v)
+{
+    CACHE_SHARDS * shards = static_cast<CACHE_SHARDS *>(v);
+
+    CACHE_STATS access[ACCESS_TYPE_NUM][2];
+    memset(access, 0, sizeof(access));
+    CACHE_STATS writebacks = 0;
+
+    for (UINT32 i = 0; i < shards->_numShards; i++)
+    {
+        const SHARD_COUNTERS & counters = shards->_counters[i];
+        for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+        {
+            access[accessType][false] += counters.access[accessType][false].load(std::memory_order_relaxed);
+            access[accessType][true] += counters.access[accessType][true].load(std::memory_order_relaxed);
+        }
+        writebacks += counters.writebacks.load(std::memory_order_relaxed);
+    }
+
+    shards->_level->SetStats(access, writebacks);
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Worker(VOID * v)
+{
+    WORKER_ARG * arg = static_cast<WORKER_ARG *>(v);
+    CACHE_SHARDS * shards = arg->shards;
+
+    while (!shards->_stop.load())
+    {
+        if (!shards->Process(arg->shard))
+            PIN_Yield();
+    }
+}
+
+template <class CACHE_T>
+BOOL CACHE_SHARDS<CACHE_T>::Start()
+{
+    for (UINT32 i = 0; i < _numShards; i++)
+    {
+        if (PIN_SpawnInternalThread(Worker, &_workerArgs[i], 0, &_workerUids[i]) == INVALID_THREADID)
+            return false;
+    }
+    return true;
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Stop()
+{
+    _stop = true;
+    for (UINT32 i = 0; i < _numShards; i++)
+    {
+        PIN_WaitForThreadTermination(_workerUids[i], PIN_INFINITE_TIMEOUT, NULL);
+    }
+    _stopped = true;
+}
+
+template <class CACHE_T>
+VOID CACHE_SHARDS<CACHE_T>::Drain()
+{
+    if (!_stopped.load())
+        Stop();
+
+    // Collect() may have filled in the level already
+    _level->ClearStats();
+    for (UINT32 i = 0; i < _numShards; i++)
+    {
+        while (Process(i))
+            ;
+        _level->MergeStats(*_slices[i]);
+    }
+}
+
+/*!
+ *  @brief Stats output method
+ */
+template <class CACHE_T>
+string CACHE_SHARDS<CACHE_T>::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+    CACHE_STATS memoryAccesses = 0;
+
+    out += prefix + "Shards:\n";
+    for (UINT32 i = 0; i < _numShards; i++)
+    {
+        out += prefix + ljstr("Shard-" + decstr(i) + "-Accesses:", headerWidth)
+               + mydecstr(_slices[i]->Accesses(), numberWidth) + "\n";
+        memoryAccesses += _memoryAccesses[i];
+    }
+    out += prefix + ljstr("Memory-Accesses: ", headerWidth)
+           + mydecstr(memoryAccesses, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_SHARD_H
@@ -0,0 +1,296 @@
+/*! @file
+ *  This file contains a last level cache split into hashed slices on a mesh
+ */
+
+#ifndef PIN_SLICE_H
+#define PIN_SLICE_H
+
+#include "dcache.h"
+
+#define MAX_LLC_SLICES 64
+
+namespace SLICE_HASH
+{
+    typedef enum
+    {
+        MODULO,         // low line address bits, like one monolithic level
+        XOR,            // every slice-wide chunk of the line address folded together
+        MIX             // multiplicative hash of the line address
+    } FUNCTION;
+}
+
+/*!
+ *  @brief Last level cache made of slices that sit on the tiles of a mesh
+ *
+ *  A line belongs to the slice the hash function picks; the slice is an
+ *  ordinary level with 1/N of the capacity that skips the slice bits when
+ *  it picks a set. Slices sit row by row on a square mesh and core c sits
+ *  on the tile of slice c modulo N. Every access from a core pays the
+ *  round trip of hops to its slice on top of the slice's own penalties,
+ *  installs from above are posted and pay nothing.
+ *
+ *  Links, inclusion policy and listeners are set on this level and handed
+ *  to the slices by Finish(). Statistics are kept here as for any level,
+ *  writebacks and back invalidations are taken over from the slices.
+ */
+class CACHE_SLICES : public CACHE_LEVEL
+{
+private:
+    const UINT32 _numSlices;
+    const UINT32 _sliceShift;
+    const UINT32 _lineShift;
+    const SLICE_HASH::FUNCTION _hash;
+    const UINT32 _hopLatency;
+    UINT32 _meshWidth;
+    UINT32 _core;               // of the access in progress
+
+    CACHE_LEVEL * _slices[MAX_LLC_SLICES];
+    CACHE_STATS _hops[MAX_LLC_SLICES];
+
+    UINT32 Slice(ADDRINT addr) const;
+    UINT32 Hops(UINT32 core, UINT32 slice) const;
+    /// Slice of addr for an access from the current core, hops paid
+    CACHE_LEVEL * Route(ADDRINT addr);
+    /// Take over what the slice counted during a call
+    VOID Merge(CACHE_LEVEL * slice, CACHE_STATS writebacks, CACHE_STATS backInvalidations);
+
+public:
+    /// create makes the slices, with the penalties of this level
+    CACHE_SLICES(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity,
+                 int hit, int miss, UINT32 numSlices, SLICE_HASH::FUNCTION hash, UINT32 hopLatency,
+                 CACHE_FACTORY create);
+
+    /// Accesses from now on come from core
+    VOID SetCore(UINT32 core) { _core = core; }
+
+    /// Wire the slices like this level, once the hierarchy is built
+    VOID Finish();
+
+    using CACHE_LEVEL::AccessSingleLine;
+
+    bool Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType);
+    bool AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill);
+    VOID Install(ADDRINT addr, bool dirty);
+    bool Invalidate(ADDRINT addr, bool & dirty);
+    bool Clean(ADDRINT addr);
+
+    string SliceStatsLong(string prefix = "") const;
+};
+
+CACHE_SLICES::CACHE_SLICES(std::string name, UINT32 cacheSize, UINT32 lineSize, UINT32 associativity,
+                           int hit, int miss, UINT32 numSlices, SLICE_HASH::FUNCTION hash, UINT32 hopLatency,
+                           CACHE_FACTORY create)
+        : CACHE_LEVEL(name, cacheSize, lineSize, associativity, hit, miss),
+          _numSlices(numSlices),
+          _sliceShift(FloorLog2(numSlices)),
+          _lineShift(FloorLog2(lineSize)),
+          _hash(hash),
+          _hopLatency(hopLatency),
+          _meshWidth(1),
+          _core(0)
+{
+    ASSERTX(IsPower2(numSlices) && numSlices > 1 && numSlices <= MAX_LLC_SLICES);
+    ASSERTX(numSlices <= NumSets());
+
+    while (_meshWidth * _meshWidth < numSlices)
+        _meshWidth++;
+
+    for (UINT32 i = 0; i < numSlices; i++)
+    {
+        _slices[i] = create(name + "slice " + decstr(i) + " ", cacheSize / numSlices,
+                            lineSize, associativity, hit, miss);
+        _slices[i]->SetIndexShift(_sliceShift);
+        _hops[i] = 0;
+    }
+}
+
+UINT32 CACHE_SLICES::Slice(ADDRINT addr) const
+{
+    ADDRINT line = addr >> _lineShift;
+
+    switch (_hash)
+    {
+      case SLICE_HASH::XOR:
+      {
+        // a power of two stride changes some chunk, and so the slice
+        UINT32 slice = 0;
+        for (; line != 0; line >>= _sliceShift)
+            slice ^= line & (_numSlices - 1);
+        return slice;
+      }
+
+      case SLICE_HASH::MIX:
+        return (line * 0x9e3779b97f4a7c15ULL) >> (64 - _sliceShift);
+
+      default:
+        return line & (_numSlices - 1);
+    }
+}
+
+UINT32 CACHE_SLICES::Hops(UINT32 core, UINT32 slice) const
+{
+    const UINT32 tile = core % _numSlices;
+    const INT32 dx = INT32(tile % _meshWidth) - INT32(slice % _meshWidth);
+    const INT32 dy = INT32(tile / _meshWidth) - INT32(slice / _meshWidth);
+
+    return abs(dx) + abs(dy);
+}
+
+CACHE_LEVEL * CACHE_SLICES::Route(ADDRINT addr)
+{
+    const UINT32 slice = Slice(addr);
+    const UINT32 hops = Hops(_core, slice);
+
+    _hops[slice] += hops;
+    if (hops != 0 && _hopLatency != 0)
+        ins_count += 2 * hops * _hopLatency;
+
+    return _slices[slice];
+}
+
+VOID CACHE_SLICES::Merge(CACHE_LEVEL * slice, CACHE_STATS writebacks, CACHE_STATS backInvalidations)
+{
+    _writebacks += slice->Writebacks() - writebacks;
+    _backInvalidations += slice->BackInvalidations() - backInvalidations;
+}
+
+VOID CACHE_SLICES::Finish()
+{
+    for (UINT32 i = 0; i < _numSlices; i++)
+    {
+        CACHE_LEVEL * slice = _slices[i];
+
+        slice->setNextLevel(next_level);
+        for (size_t p = 0; p < prev_levels.size(); p++)
+            slice->addPrevLevel(prev_levels[p]);
+        slice->setInclusion(inclusion);
+        slice->setEvictListener(evict_listener, evict_listener_arg, evict_listener_id);
+        slice->setMissListener(miss_listener, miss_listener_arg);
+        slice->setMemoryCounter(memory_counter);
+    }
+}
+
+/*!
+ *  @return true if all accessed cache lines hit
+ */
+bool CACHE_SLICES::Access(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType)
+{
+    const ADDRINT highAddr = addr + size;
+    const ADDRINT lineSize = LineSize();
+    const ADDRINT notLineMask = ~(lineSize - 1);
+
+    bool allHit = true;
+    do
+    {
+        CACHE_LEVEL * slice = Route(addr);
+        const CACHE_STATS writebacks = slice->Writebacks();
+        const CACHE_STATS backInvalidations = slice->BackInvalidations();
+
+        allHit &= slice->AccessSingleLine(addr, accessType);
+        Merge(slice, writebacks, backInvalidations);
+
+        addr = (addr & notLineMask) + lineSize; // start of next cache line
+    }
+    while (addr < highAddr);
+
+    _access[accessType][allHit]++;
+
+    return allHit;
+}
+
+bool CACHE_SLICES::AccessSingleLine(ADDRINT addr, ACCESS_TYPE accessType, bool & dirtyFill)
+{
+    CACHE_LEVEL * slice = Route(addr);
+    const CACHE_STATS writebacks = slice->Writebacks();
+    const CACHE_STATS backInvalidations = slice->BackInvalidations();
+
+    const bool hit = slice->AccessSingleLine(addr, accessType, dirtyFill);
+    Merge(slice, writebacks, backInvalidations);
+
+    _access[accessType][hit]++;
+    return hit;
+}
+
+VOID CACHE_SLICES::Install(ADDRINT addr, bool dirty)
+{
+    CACHE_LEVEL * slice = _slices[Slice(addr)];
+    const CACHE_STATS writebacks = slice->Writebacks();
+    const CACHE_STATS backInvalidations = slice->BackInvalidations();
+    const CACHE_STATS hits = slice->Installs(true);
+
+    slice->Install(addr, dirty);
+    Merge(slice, writebacks, backInvalidations);
+
+    _install[slice->Installs(true) != hits]++;
+}
+
+bool CACHE_SLICES::Invalidate(ADDRINT addr, bool & dirty)
+{
+    CACHE_LEVEL * slice = _slices[Slice(addr)];
+    const CACHE_STATS writebacks = slice->Writebacks();
+    const CACHE_STATS backInvalidations = slice->BackInvalidations();
+
+    const bool found = slice->Invalidate(addr, dirty);
+    Merge(slice, writebacks, backInvalidations);
+
+    return found;
+}
+
+bool CACHE_SLICES::Clean(ADDRINT addr)
+{
+    return _slices[Slice(addr)]->Clean(addr);
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string CACHE_SLICES::SliceStatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    CACHE_STATS total = 0;
+    CACHE_STATS busiest = 0;
+    CACHE_STATS hops = 0;
+    for (UINT32 i = 0; i < _numSlices; i++)
+    {
+        total += _slices[i]->Accesses();
+        busiest = std::max(busiest, _slices[i]->Accesses());
+        hops += _hops[i];
+    }
+    const double mean = double(total) / _numSlices;
+
+    string out;
+
+    out += prefix + ljstr("Slices:          ", headerWidth)
+           + mydecstr(_numSlices, numberWidth) + "\n";
+    out += prefix + ljstr("Hash:            ", headerWidth)
+           + (_hash == SLICE_HASH::XOR ? "xor" : _hash == SLICE_HASH::MIX ? "mix" : "mod") + "\n";
+    out += prefix + ljstr("Avg-Hops:        ", headerWidth)
+           + fltstr(total ? double(hops) / total : 0.0, 2, numberWidth) + "\n";
+    // busiest slice over the mean, 1.00 is a perfect spread
+    out += prefix + ljstr("Imbalance:       ", headerWidth)
+           + fltstr(total ? busiest / mean : 0.0, 2, numberWidth) + "\n";
+    out += prefix + "\n";
+
+    out += prefix + ljstr("slice", 6)
+           + "      accesses     share      misses   miss%    avg-hops  writebacks\n";
+    for (UINT32 i = 0; i < _numSlices; i++)
+    {
+        const CACHE_LEVEL * slice = _slices[i];
+        const CACHE_STATS accesses = slice->Accesses();
+
+        out += prefix + ljstr(decstr(i), 6)
+               + mydecstr(accesses, numberWidth + 2)
+               + "  " + fltstr(total ? 100.0 * accesses / total : 0.0, 2, 6) + "%"
+               + mydecstr(slice->Misses(), numberWidth)
+               + "  " + fltstr(accesses ? 100.0 * slice->Misses() / accesses : 0.0, 2, 6) + "%"
+               + fltstr(accesses ? double(_hops[i]) / accesses : 0.0, 2, numberWidth)
+               + mydecstr(slice->Writebacks(), numberWidth) + "\n";
+    }
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_SLICE_H
@@ -0,0 +1,49 @@
+/*! @file
+ *  This file contains the layout of the live statistics page shared
+ *  between the tool and statsview; it does not depend on Pin
+ */
+
+#ifndef PIN_STATSPAGE_H
+#define PIN_STATSPAGE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define STATS_PAGE_MAGIC 0x5453484341434444ULL     // "DDCACHST"
+#define STATS_PAGE_VERSION 2
+#define STATS_PAGE_MAX_LEVELS 8
+#define STATS_PAGE_NAME_SIZE 16
+
+typedef struct
+{
+    char name[STATS_PAGE_NAME_SIZE];
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> writebacks;
+} STATS_PAGE_LEVEL;
+
+/*!
+ *  @brief Counters the tool publishes with relaxed stores every epoch
+ *
+ *  The header fields are written once before the first update. A reader
+ *  may see counters of different updates mixed, updates tells it whether
+ *  anything moved at all.
+ */
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t numLevels;
+    std::atomic<uint32_t> done;             // set by the tool's fini
+    std::atomic<uint64_t> updates;
+    std::atomic<uint64_t> timestamp;        // wall clock of the last update in seconds
+    std::atomic<uint64_t> insCount;         // retired instructions
+    std::atomic<uint64_t> clock;            // instructions plus simulated penalties
+    std::atomic<uint64_t> memBeforeWarmup;
+    std::atomic<uint64_t> memAfterWarmup;
+    std::atomic<uint64_t> traceBytes;
+    STATS_PAGE_LEVEL levels[STATS_PAGE_MAX_LEVELS];
+} STATS_PAGE;
+
+#endif // PIN_STATSPAGE_H
@@ -0,0 +1,102 @@
+/*! @file
+ *  Watches the live statistics page of a running dcache tool:
+ *
+ *      statsview /dev/shm/dcache.stats [seconds]
+ *
+ *  Build it standalone, it does not need Pin:
+ *
+ *      g++ -std=c++11 -O2 -o statsview statsview.cpp
+ *
+ *  Exits with 0 once the run finished, with 1 if the page is not valid
+ *  and with 2 if the tool went away without finishing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "statspage.h"
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <stats page> [seconds]\n", argv[0]);
+        return 1;
+    }
+    unsigned period = 1;
+    if (argc > 2)
+    {
+        char * end;
+        const long value = strtol(argv[2], &end, 10);
+        if (end == argv[2] || *end != 0 || value < 1 || value > 86400)
+        {
+            fprintf(stderr, "%s: the period has to be a whole number of seconds from 1 to 86400\n", argv[0]);
+            return 1;
+        }
+        period = value;
+    }
+
+    const int fd = open(argv[1], O_RDONLY);
+    if (fd < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    void * map = mmap(NULL, sizeof(STATS_PAGE), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    const STATS_PAGE * page = static_cast<const STATS_PAGE *>(map);
+    if (page->magic != STATS_PAGE_MAGIC || page->version != STATS_PAGE_VERSION)
+    {
+        fprintf(stderr, "%s is not a version %d stats page\n", argv[1], STATS_PAGE_VERSION);
+        return 1;
+    }
+
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    uint64_t lastIns = page->insCount.load(relaxed);
+
+    for (;;)
+    {
+        const bool done = page->done.load(std::memory_order_acquire) != 0;
+        const uint64_t ins = page->insCount.load(relaxed);
+
+        printf("pid %d ins %llu (%.2f M/s) clock %llu mem %llu+%llu trace %.1f MB",
+               page->pid, (unsigned long long) ins, (ins - lastIns) / 1e6 / period,
+               (unsigned long long) page->clock.load(relaxed),
+               (unsigned long long) page->memBeforeWarmup.load(relaxed),
+               (unsigned long long) page->memAfterWarmup.load(relaxed),
+               page->traceBytes.load(relaxed) / 1e6);
+        for (uint32_t i = 0; i < page->numLevels && i < STATS_PAGE_MAX_LEVELS; i++)
+        {
+            const STATS_PAGE_LEVEL & level = page->levels[i];
+            const uint64_t hits = level.hits.load(relaxed);
+            const uint64_t misses = level.misses.load(relaxed);
+            printf(" | %.*s miss %.2f%% wb %llu", STATS_PAGE_NAME_SIZE, level.name,
+                   (hits + misses) ? 100.0 * misses / (hits + misses) : 0.0,
+                   (unsigned long long) level.writebacks.load(relaxed));
+        }
+        printf("%s\n", done ? " | done" : "");
+        fflush(stdout);
+
+        if (done)
+            return 0;
+        if (kill(page->pid, 0) != 0 && errno == ESRCH)
+        {
+            fprintf(stderr, "pid %d exited without finishing\n", page->pid);
+            return 2;
+        }
+
+        lastIns = ins;
+        sleep(period);
+    }
+}
@@ -0,0 +1,244 @@
+/*! @file
+ *  This file contains a multi-level data TLB with a page walker
+ */
+
+#ifndef PIN_TLB_H
+#define PIN_TLB_H
+
+#include "dcache.h"
+
+typedef enum
+{
+    TLB_PAGE_4K,
+    TLB_PAGE_2M,
+    TLB_PAGE_1G,
+    TLB_PAGE_NUM
+} TLB_PAGE_SIZE;
+
+static const UINT32 TLB_PAGE_SHIFT[TLB_PAGE_NUM] = { 12, 21, 30 };
+
+// radix levels touched by a full walk: PML4E, PDPTE, PDE, PTE
+#define TLB_MAX_WALK 4
+#define TLB_MAX_ASSOCIATIVITY 32
+#define TLB_PDE_ASSOCIATIVITY 4
+
+// page tables live in the upper canonical half so they never alias
+// application data; every radix level gets its own 1 TB region
+const ADDRINT PAGE_TABLE_BASE = 0xFFFF800000000000ULL;
+
+/*!
+ *  @brief One set associative translation buffer with LRU replacement
+ */
+class TLB_LEVEL
+{
+private:
+    const std::string _name;
+    const UINT32 _entries;
+    const UINT32 _setIndexMask;
+    CACHE_SET::LRU<TLB_MAX_ASSOCIATIVITY> * _sets;
+    CACHE_STATS _access[2];
+
+public:
+    TLB_LEVEL(std::string name, UINT32 entries, UINT32 associativity)
+            : _name(name),
+              _entries(entries),
+              _setIndexMask(entries / associativity - 1)
+    {
+        ASSERTX(Valid(entries, associativity));
+
+        _sets = new CACHE_SET::LRU<TLB_MAX_ASSOCIATIVITY>[_setIndexMask + 1];
+        for (UINT32 i = 0; i <= _setIndexMask; i++)
+        {
+            _sets[i].SetAssociativity(associativity);
+        }
+        _access[false] = 0;
+        _access[true] = 0;
+    }
+
+    /// @return true if entries fill a power of two number of sets of
+    /// associativity ways
+    static bool Valid(UINT32 entries, UINT32 associativity)
+    {
+        return associativity != 0 && associativity <= TLB_MAX_ASSOCIATIVITY &&
+               entries % associativity == 0 && IsPower2(entries / associativity);
+    }
+
+    /// Look up key, installing it on a miss
+    /// @return true on hit
+    bool Lookup(ADDRINT key)
+    {
+        CACHE_SET::LRU<TLB_MAX_ASSOCIATIVITY> & set = _sets[key & _setIndexMask];
+        const bool hit = set.Find(CACHE_TAG(key), ACCESS_TYPE_LOAD);
+        if (!hit)
+            set.Replace(CACHE_TAG(key), ACCESS_TYPE_LOAD);
+        _access[hit]++;
+        return hit;
+    }
+
+    CACHE_STATS Hits() const { return _access[true]; }
+    CACHE_STATS Misses() const { return _access[false]; }
+    CACHE_STATS Accesses() const { return Hits() + Misses(); }
+    std::string GetName() const { return _name; }
+};
+
+/*!
+ *  @brief L1 DTLB (one array per page size) backed by a unified STLB, a
+ *  page directory entry cache and a 4-level radix page walker.
+ *
+ *  The TLB only decides which page table entries have to be read; the
+ *  caller issues them into the cache hierarchy and reports back the
+ *  traffic the walk caused through AccountWalk().
+ */
+class TLB
+{
+private:
+    TLB_LEVEL * _l1[TLB_PAGE_NUM];
+    TLB_LEVEL * _stlb;
+    TLB_LEVEL * _pdeCache;      // NULL if disabled
+    const TLB_PAGE_SIZE _pageSize;
+    const UINT32 _stlbPenalty;
+
+    CACHE_STATS _walks;
+    CACHE_STATS _walkRefs;
+    CACHE_STATS _walkL1Hits;
+    CACHE_STATS _walkL2Accesses;
+    CACHE_STATS _walkMemAccesses;
+
+    static std::string LevelStats(std::string prefix, const TLB_LEVEL * level);
+
+public:
+    TLB(TLB_PAGE_SIZE pageSize,
+        UINT32 l1Entries, UINT32 l1Associativity,
+        UINT32 stlbEntries, UINT32 stlbAssociativity,
+        UINT32 pdeEntries, UINT32 stlbPenalty);
+
+    TLB_PAGE_SIZE PageSize() const { return _pageSize; }
+
+    /// Translate addr
+    /// @return number of page table entries written to pte that the page
+    /// walk has to read, 0 if the translation hit in the TLBs
+    UINT32 Translate(ADDRINT addr, ADDRINT pte[TLB_MAX_WALK]);
+
+    VOID AccountWalk(UINT32 l1Hits, CACHE_STATS l2Accesses, CACHE_STATS memAccesses)
+    {
+        _walkL1Hits += l1Hits;
+        _walkL2Accesses += l2Accesses;
+        _walkMemAccesses += memAccesses;
+    }
+
+    string StatsLong(string prefix = "") const;
+};
+
+TLB::TLB(TLB_PAGE_SIZE pageSize,
+         UINT32 l1Entries, UINT32 l1Associativity,
+         UINT32 stlbEntries, UINT32 stlbAssociativity,
+         UINT32 pdeEntries, UINT32 stlbPenalty)
+        : _pageSize(pageSize),
+          _stlbPenalty(stlbPenalty)
+{
+    // 2M and 1G arrays follow a Skylake-like L1 DTLB
+    _l1[TLB_PAGE_4K] = new TLB_LEVEL("L1 DTLB 4K ", l1Entries, l1Associativity);
+    _l1[TLB_PAGE_2M] = new TLB_LEVEL("L1 DTLB 2M ", 32, 4);
+    _l1[TLB_PAGE_1G] = new TLB_LEVEL("L1 DTLB 1G ", 4, 4);
+    _stlb = new TLB_LEVEL("STLB ", stlbEntries, stlbAssociativity);
+    _pdeCache = (pdeEntries != 0) ? new TLB_LEVEL("PDE Cache ", pdeEntries, TLB_PDE_ASSOCIATIVITY) : NULL;
+
+    _walks = 0;
+    _walkRefs = 0;
+    _walkL1Hits = 0;
+    _walkL2Accesses = 0;
+    _walkMemAccesses = 0;
+}
+
+UINT32 TLB::Translate(ADDRINT addr, ADDRINT pte[TLB_MAX_WALK])
+{
+    const ADDRINT vpn = addr >> TLB_PAGE_SHIFT[_pageSize];
+
+    if (_l1[_pageSize]->Lookup(vpn))
+        return 0;
+
+    // STLB is shared by all page sizes, keep the size out of the set index bits
+    if (_stlb->Lookup(vpn | (ADDRINT(_pageSize) << 56)))
+    {
+        ins_count += _stlbPenalty;
+        return 0;
+    }
+
+    _walks++;
+
+    // radix level 0 is the PML4, level 3 the last level page table
+    const UINT32 lastLevel = TLB_MAX_WALK - 1 - _pageSize;
+    UINT32 firstLevel = 0;
+
+    // a PDE cache hit skips straight to the last level page table
+    if (_pageSize == TLB_PAGE_4K && _pdeCache != NULL && _pdeCache->Lookup(addr >> 21))
+        firstLevel = lastLevel;
+
+    UINT32 refs = 0;
+    for (UINT32 level = firstLevel; level <= lastLevel; level++)
+    {
+        const UINT32 shift = 39 - 9 * level;
+        pte[refs++] = PAGE_TABLE_BASE + (ADDRINT(level) << 40) + ((addr >> shift) << 3);
+    }
+    _walkRefs += refs;
+
+    return refs;
+}
+
+std::string TLB::LevelStats(std::string prefix, const TLB_LEVEL * level)
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + level->GetName() + ":" + "\n";
+
+    out += prefix + ljstr("Hits:            ", headerWidth)
+           + mydecstr(level->Hits(), numberWidth) +
+           "  " +fltstr(100.0 * level->Hits() / level->Accesses(), 2, 6) + "%\n";
+
+    out += prefix + ljstr("Misses:          ", headerWidth)
+           + mydecstr(level->Misses(), numberWidth) +
+           "  " +fltstr(100.0 * level->Misses() / level->Accesses(), 2, 6) + "%\n";
+
+    out += prefix + ljstr("Accesses:        ", headerWidth)
+           + mydecstr(level->Accesses(), numberWidth) + "\n";
+    out += prefix + "\n";
+
+    return out;
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string TLB::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += LevelStats(prefix, _l1[_pageSize]);
+    out += LevelStats(prefix, _stlb);
+    if (_pdeCache != NULL)
+        out += LevelStats(prefix, _pdeCache);
+
+    out += prefix + "Page Walks:\n";
+    out += prefix + ljstr("Walks:           ", headerWidth)
+           + mydecstr(_walks, numberWidth) + "\n";
+    out += prefix + ljstr("PTE-Reads:       ", headerWidth)
+           + mydecstr(_walkRefs, numberWidth) + "\n";
+    out += prefix + ljstr("PTE-L1-Hits:     ", headerWidth)
+           + mydecstr(_walkL1Hits, numberWidth) +
+           "  " +fltstr(100.0 * _walkL1Hits / _walkRefs, 2, 6) + "%\n";
+    out += prefix + ljstr("Walk-L2-Accesses:", headerWidth)
+           + mydecstr(_walkL2Accesses, numberWidth) + "\n";
+    out += prefix + ljstr("Walk-Mem-Accesses:", headerWidth)
+           + mydecstr(_walkMemAccesses, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_TLB_H
@@ -0,0 +1,198 @@
+/*! @file
+ *  This file contains the write-combining buffer for non-temporal stores
+ */
+
+#ifndef PIN_WCBUFFER_H
+#define PIN_WCBUFFER_H
+
+#include "dcache.h"
+
+#define WC_MAX_ENTRIES 64
+
+/*!
+ *  @brief MOVNT* and MASKMOV* stores, only known by their mnemonic
+ */
+bool IsNonTemporalStore(INS ins)
+{
+    if (!INS_IsMemoryWrite(ins))
+        return false;
+
+    const string mnemonic = INS_Mnemonic(ins);
+    return mnemonic.compare(0, 5, "MOVNT") == 0 || mnemonic.compare(0, 6, "VMOVNT") == 0 ||
+           mnemonic.compare(0, 7, "MASKMOV") == 0 || mnemonic.compare(0, 8, "VMASKMOV") == 0;
+}
+
+/*!
+ *  @brief Instructions that drain the write-combining buffers
+ */
+bool IsStoreFence(INS ins)
+{
+    const string mnemonic = INS_Mnemonic(ins);
+    return mnemonic == "SFENCE" || mnemonic == "MFENCE" || INS_LockPrefix(ins);
+}
+
+/*!
+ *  @brief Fill buffers that collect non-temporal stores next to the L1
+ *
+ *  A streaming store never allocates: the line is dropped from every
+ *  level and the bytes collect in a buffer. A buffer whose line is
+ *  completely written goes to memory as one full line write. Otherwise
+ *  it stays open until it is the oldest one and a new line needs a
+ *  buffer, or until a fence. Such a partial line goes out as a line
+ *  write as well, but is counted separately.
+ */
+class WC_BUFFER
+{
+private:
+    typedef struct
+    {
+        ADDRINT line;
+        UINT64 written;         // one bit per byte
+        UINT64 opened;
+    } ENTRY;
+
+    CACHE_LEVEL * const _l1;
+    const UINT32 _numEntries;
+    const UINT32 _lineSize;
+    const UINT64 _full;
+
+    ENTRY _entries[WC_MAX_ENTRIES];
+    UINT32 _used;
+    UINT64 _clock;
+
+    CACHE_STATS _stores;
+    CACHE_STATS _purged;
+    CACHE_STATS _fullLines;
+    CACHE_STATS _partialLines;
+    CACHE_STATS _fences;
+
+    VOID Write(UINT32 index);
+    VOID StoreLine(ADDRINT line, UINT32 offset, UINT32 size);
+
+public:
+    WC_BUFFER(CACHE_LEVEL * l1, UINT32 numEntries);
+
+    /// Non-temporal store from addr to addr+size-1
+    VOID Store(ADDRINT addr, UINT32 size);
+    /// Write out every open buffer
+    VOID Fence();
+
+    string StatsLong(string prefix = "") const;
+};
+
+WC_BUFFER::WC_BUFFER(CACHE_LEVEL * l1, UINT32 numEntries)
+        : _l1(l1),
+          _numEntries(numEntries),
+          _lineSize(l1->LineSize()),
+          _full((l1->LineSize() == 64) ? ~UINT64(0) : (UINT64(1) << l1->LineSize()) - 1),
+          _used(0),
+          _clock(0),
+          _stores(0),
+          _purged(0),
+          _fullLines(0),
+          _partialLines(0),
+          _fences(0)
+{
+    ASSERTX(numEntries != 0 && numEntries <= WC_MAX_ENTRIES);
+    ASSERTX(_lineSize <= 64);
+}
+
+/*!
+ *  @brief Send buffer index to memory and free it
+ */
+VOID WC_BUFFER::Write(UINT32 index)
+{
+    ENTRY & entry = _entries[index];
+
+    if (entry.written == _full)
+        _fullLines++;
+    else
+        _partialLines++;
+    _l1->WriteMemory(entry.line);
+
+    entry = _entries[--_used];
+}
+
+VOID WC_BUFFER::StoreLine(ADDRINT line, UINT32 offset, UINT32 size)
+{
+    UINT32 index = 0;
+    while (index < _used && _entries[index].line != line)
+        index++;
+
+    if (index == _used)
+    {
+        if (_used == _numEntries)
+        {
+            UINT32 oldest = 0;
+            for (UINT32 i = 1; i < _used; i++)
+            {
+                if (_entries[i].opened < _entries[oldest].opened)
+                    oldest = i;
+            }
+            Write(oldest);
+        }
+
+        _purged += _l1->Purge(line);
+
+        index = _used++;
+        _entries[index].line = line;
+        _entries[index].written = 0;
+        _entries[index].opened = _clock++;
+    }
+
+    const UINT64 bytes = (size == 64) ? ~UINT64(0) : ((UINT64(1) << size) - 1);
+    _entries[index].written |= bytes << offset;
+
+    if (_entries[index].written == _full)
+        Write(index);
+}
+
+VOID WC_BUFFER::Store(ADDRINT addr, UINT32 size)
+{
+    _stores++;
+
+    const ADDRINT notLineMask = ~ADDRINT(_lineSize - 1);
+    const ADDRINT last = addr + size - 1;
+
+    for (ADDRINT line = addr & notLineMask; line <= (last & notLineMask); line += _lineSize)
+    {
+        const ADDRINT first = std::max(addr, line);
+        const ADDRINT end = std::min(last, line + _lineSize - 1);
+        StoreLine(line, first - line, end - first + 1);
+    }
+}
+
+VOID WC_BUFFER::Fence()
+{
+    if (_used != 0)
+        _fences++;
+    while (_used != 0)
+        Write(_used - 1);
+}
+
+/*!
+ *  @brief Stats output method
+ */
+string WC_BUFFER::StatsLong(string prefix) const
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    string out;
+
+    out += prefix + ljstr("NT-Stores:       ", headerWidth)
+           + mydecstr(_stores, numberWidth) + "\n";
+    out += prefix + ljstr("Lines-Purged:    ", headerWidth)
+           + mydecstr(_purged, numberWidth) + "\n";
+    out += prefix + ljstr("Full-Lines:      ", headerWidth)
+           + mydecstr(_fullLines, numberWidth) + "\n";
+    out += prefix + ljstr("Partial-Lines:   ", headerWidth)
+           + mydecstr(_partialLines, numberWidth) + "\n";
+    out += prefix + ljstr("Fence-Drains:    ", headerWidth)
+           + mydecstr(_fences, numberWidth) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // PIN_WCBUFFER_H